@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stddef.h>
 #include <math.h>
+#include <mutex>
 
 /* Copyright (C) 2003-2005 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
@@ -24,6 +25,8 @@ Blip_Buffer::Blip_Buffer()
 {
 	samples_per_sec = 44100;
 	buffer_ = NULL;
+	buffer_begin_ = NULL;
+	slide_size_ = 0;
 	
 	// try to cause assertion failure if buffer is used before these are set
 	clocks_per_sec = 0;
@@ -37,13 +40,21 @@ Blip_Buffer::Blip_Buffer()
 
 void Blip_Buffer::clear( bool entire_buffer )
 {
-	long count = (entire_buffer ? buffer_size_ : samples_avail());
+	long count = samples_avail();
+	if ( entire_buffer )
+	{
+		buffer_ = buffer_begin_;
+		count = buffer_size_ + slide_size_;
+	}
 	offset_ = 0;
 	reader_accum = 0;
 	if ( buffer_ )
 		memset( buffer_, sample_offset_ & 0xFF, (count + widest_impulse_) * sizeof (buf_t_) );
 }
 
+// Number of samples buffer_ can advance before unread samples are moved back
+const unsigned max_slide = 4096;
+
 blargg_err_t Blip_Buffer::set_sample_rate( long new_rate, int msec )
 {
 	unsigned new_size = (UINT_MAX >> BLIP_BUFFER_ACCURACY) + 1 - widest_impulse_ - 64;
@@ -58,14 +69,23 @@ blargg_err_t Blip_Buffer::set_sample_rate( long new_rate, int msec )
 	
 	if ( buffer_size_ != new_size )
 	{
-		delete [] buffer_;
+		delete [] buffer_begin_;
 		buffer_ = NULL; // allow for exception in allocation below
+		buffer_begin_ = NULL;
 		buffer_size_ = 0;
+		slide_size_ = 0;
 		offset_ = 0;
 		
+		// Reading advances buffer_ instead of moving unread samples down, so
+		// room is left for it to slide into. Unread samples are only moved
+		// back to the beginning once it has slid this far.
+		unsigned slide = new_size < max_slide ? new_size : max_slide;
+		
 		int const count_clocks_extra = 2;
-		buffer_ = BLARGG_NEW buf_t_ [new_size + widest_impulse_ + count_clocks_extra];
-		BLARGG_CHECK_ALLOC( buffer_ );
+		buffer_begin_ = BLARGG_NEW buf_t_ [new_size + slide + widest_impulse_ + count_clocks_extra];
+		BLARGG_CHECK_ALLOC( buffer_begin_ );
+		buffer_ = buffer_begin_;
+		slide_size_ = slide;
 	}
 	
 	buffer_size_ = new_size;
@@ -94,22 +114,31 @@ blip_resampled_time_t Blip_Buffer::clock_rate_factor( long clock_rate ) const
 
 Blip_Buffer::~Blip_Buffer()
 {
-	delete [] buffer_;
+	delete [] buffer_begin_;
+}
+
+int Blip_Buffer::bass_shift_for( long sample_rate, int freq )
+{
+	if ( freq == 0 )
+		return 31; // 32 or greater invokes undefined behavior elsewhere
+	
+	int shift = 1 + (int) floor( 1.442695041 * log( 0.124 * sample_rate / freq ) );
+	if ( shift < 0 )
+		shift = 0;
+	if ( shift > 24 )
+		shift = 24;
+	return shift;
 }
 
 void Blip_Buffer::bass_freq( int freq )
+{
+	bass_freq( freq, bass_shift_for( samples_per_sec, freq ) );
+}
+
+void Blip_Buffer::bass_freq( int freq, int shift )
 {
 	bass_freq_ = freq;
-	if ( freq == 0 )
-	{
-		bass_shift = 31; // 32 or greater invokes undefined behavior elsewhere
-		return;
-	}
-	bass_shift = 1 + (int) floor( 1.442695041 * log( 0.124 * samples_per_sec / freq ) );
-	if ( bass_shift < 0 )
-		bass_shift = 0;
-	if ( bass_shift > 24 )
-		bass_shift = 24;
+	bass_shift = shift;
 }
 
 long Blip_Buffer::count_samples( blip_time_t t ) const
@@ -125,30 +154,134 @@ blip_time_t Blip_Buffer::count_clocks( long count ) const
 	return ((count << BLIP_BUFFER_ACCURACY) - offset_ + (factor_ - 1)) / factor_;
 }
 
-void Blip_Impulse_::init( blip_pair_t_* imps, int w, int r, int fb )
+// Impulse tables shared by all synths with the same settings
+
+struct blip_impulse_table_ {
+	blip_impulse_table_* next;
+	int refs;
+	int width;
+	int res;
+	int fine_bits;
+	double treble;
+	long cutoff;
+	long sample_rate;
+	double volume_unit;
+	long size;
+	blip_pair_t_* impulses;
+};
+
+static std::mutex impulse_tables_mutex;
+static blip_impulse_table_* impulse_tables = NULL; // most recently added first
+
+// Tables nobody uses are kept for a while, since a synth usually switches from
+// the default equalization to its own right after construction. A Gb_Apu has
+// eight synths (four quality tiers of two kinds), so this keeps the default
+// tables and one other equalization's for a whole chip.
+const int max_unused_tables = 16;
+static int unused_tables = 0;
+
+static void release_impulse_table( blip_impulse_table_* t )
+{
+	if ( !t || --t->refs )
+		return;
+	
+	if ( ++unused_tables <= max_unused_tables )
+		return;
+	
+	// free oldest unused table
+	blip_impulse_table_** oldest = NULL;
+	for ( blip_impulse_table_** p = &impulse_tables; *p; p = &(*p)->next )
+		if ( !(*p)->refs )
+			oldest = p;
+	
+	t = *oldest;
+	*oldest = t->next;
+	unused_tables--;
+	
+	delete [] t->impulses;
+	delete t;
+}
+
+int Blip_Impulse_::shared_tables()
+{
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	int count = 0;
+	for ( blip_impulse_table_* t = impulse_tables; t; t = t->next )
+		count++;
+	return count;
+}
+
+long Blip_Impulse_::shared_bytes()
+{
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	long bytes = 0;
+	for ( blip_impulse_table_* t = impulse_tables; t; t = t->next )
+		bytes += t->size * long (sizeof (blip_pair_t_));
+	return bytes;
+}
+
+Blip_Impulse_::Blip_Impulse_( int w, int r, int fb, long s )
 {
 	fine_bits = fb;
 	width = w;
-	impulses = (imp_t*) imps;
-	generate = true;
-	volume_unit_ = -1.0;
 	res = r;
+	size = s;
+	has_eq = false;
+	volume_unit_ = -1.0;
+	table = NULL;
+	prepared = NULL;
+	for ( int i = 0; i < max_retired; i++ )
+		retired [i] = NULL;
+	impulses = NULL;
 	buf = NULL;
-	
-	impulse = &impulses [width * res * 2 * (fine_bits ? 2 : 1)];
 	offset = 0;
 }
 
+Blip_Impulse_::Blip_Impulse_( const Blip_Impulse_& other ) :
+	eq( other.eq ),
+	volume_unit_( other.volume_unit_ ),
+	table( other.table ),
+	size( other.size ),
+	width( other.width ),
+	fine_bits( other.fine_bits ),
+	res( other.res ),
+	has_eq( other.has_eq ),
+	prepared( NULL ),
+	impulses( other.impulses ),
+	buf( other.buf ),
+	offset( other.offset )
+{
+	for ( int i = 0; i < max_retired; i++ )
+		retired [i] = NULL;
+	
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	if ( table )
+		table->refs++;
+}
+
+Blip_Impulse_::~Blip_Impulse_()
+{
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	release_impulse_table( table );
+	release_impulse_table( prepared );
+	release_retired();
+}
+
+Blip_Impulse_::imp_t* Blip_Impulse_::base_impulse( imp_t* imps ) const
+{
+	return &imps [width * res * 2 * (fine_bits ? 2 : 1)];
+}
+
 const int impulse_bits = 15;
 const long impulse_amp = 1L << impulse_bits;
 const long impulse_offset = impulse_amp / 2;
 
-void Blip_Impulse_::scale_impulse( int unit, imp_t* imp_in ) const
+void Blip_Impulse_::scale_impulse( int unit, imp_t* base, imp_t* imp_in ) const
 {
 	long offset = ((long) unit << impulse_bits) - impulse_offset * unit +
 			(1 << (impulse_bits - 1));
 	imp_t* imp = imp_in;
-	imp_t* fimp = impulse;
+	const imp_t* fimp = base;
 	for ( int n = res / 2 + 1; n--; )
 	{
 		int error = unit;
@@ -187,14 +320,15 @@ void Blip_Impulse_::scale_impulse( int unit, imp_t* imp_in ) const
 
 const int max_res = 1 << blip_res_bits_;
 
-void Blip_Impulse_::fine_volume_unit()
+void Blip_Impulse_::fine_volume_unit( imp_t* impulses, BOOST::uint32_t offset ) const
 {
 	// to do: find way of merging in-place without temporary buffer
 	
+	imp_t* base = base_impulse( impulses );
 	imp_t temp [max_res * 2 * Blip_Buffer::widest_impulse_];
-	scale_impulse( (offset & 0xffff) << fine_bits, temp );
+	scale_impulse( (offset & 0xffff) << fine_bits, base, temp );
 	imp_t* imp2 = impulses + res * 2 * width;
-	scale_impulse( offset & 0xffff, imp2 );
+	scale_impulse( offset & 0xffff, base, imp2 );
 	
 	// merge impulses
 	imp_t* imp = impulses;
@@ -213,30 +347,149 @@ void Blip_Impulse_::volume_unit( double new_unit )
 	if ( new_unit == volume_unit_ )
 		return;
 	
-	if ( generate )
-		treble_eq( blip_eq_t( -8.87, 8800, 44100 ) );
+	if ( !has_eq )
+	{
+		eq = blip_eq_t( -8.87, 8800, 44100 );
+		has_eq = true;
+	}
 	
 	volume_unit_ = new_unit;
 	
 	offset = BOOST::uint32_t (0x10001 * (unsigned long) floor( volume_unit_ * 0x10000 + 0.5 ));
 	
-	if ( fine_bits )
-		fine_volume_unit();
-	else
-		scale_impulse( offset & 0xffff, impulses );
+	update();
 }
 
-static const double pi = 3.1415926535897932384626433832795029L;
-
 void Blip_Impulse_::treble_eq( const blip_eq_t& new_eq )
 {
-	if ( !generate && new_eq.treble == eq.treble && new_eq.cutoff == eq.cutoff &&
+	if ( has_eq && new_eq.treble == eq.treble && new_eq.cutoff == eq.cutoff &&
 			new_eq.sample_rate == eq.sample_rate )
-		return; // already calculated with same parameters
+	{
+		// already calculated with same parameters, but anything prepared since
+		// would replace them
+		if ( prepared.load() )
+		{
+			std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+			release_impulse_table( prepared.exchange( NULL ) );
+		}
+		return;
+	}
 	
-	generate = false;
+	has_eq = true;
 	eq = new_eq;
 	
+	if ( volume_unit_ >= 0 )
+		update();
+}
+
+// Points impulses at the shared table for the current settings, generating it
+// if no other synth uses them. Impulses still waiting to be taken are dropped,
+// since they were prepared for the old settings.
+void Blip_Impulse_::update()
+{
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	
+	blip_impulse_table_* t = acquire_table( eq );
+	release_impulse_table( table );
+	release_impulse_table( prepared.exchange( NULL ) );
+	release_retired();
+	table = t;
+	impulses = t->impulses;
+}
+
+// Shared table for 'new_eq' and the current volume unit, with a reference
+// added for the caller, who must hold impulse_tables_mutex
+blip_impulse_table_* Blip_Impulse_::acquire_table( const blip_eq_t& new_eq ) const
+{
+	blip_impulse_table_* t = impulse_tables;
+	while ( t && !(t->width == width && t->res == res && t->fine_bits == fine_bits &&
+			t->treble == new_eq.treble && t->cutoff == new_eq.cutoff &&
+			t->sample_rate == new_eq.sample_rate && t->volume_unit == volume_unit_) )
+		t = t->next;
+	
+	if ( !t )
+	{
+		t = new blip_impulse_table_;
+		t->refs = 1;
+		t->width = width;
+		t->res = res;
+		t->fine_bits = fine_bits;
+		t->treble = new_eq.treble;
+		t->cutoff = new_eq.cutoff;
+		t->sample_rate = new_eq.sample_rate;
+		t->volume_unit = volume_unit_;
+		t->size = size;
+		t->impulses = new blip_pair_t_ [size];
+		
+		imp_t* imps = (imp_t*) t->impulses;
+		generate( imps, new_eq );
+		if ( fine_bits )
+			fine_volume_unit( imps, offset );
+		else
+			scale_impulse( offset & 0xffff, base_impulse( imps ), imps );
+		
+		t->next = impulse_tables;
+		impulse_tables = t;
+	}
+	else if ( !t->refs++ )
+	{
+		unused_tables--;
+	}
+	
+	return t;
+}
+
+void Blip_Impulse_::prepare_eq( const blip_eq_t& new_eq )
+{
+	require( volume_unit_ >= 0 );
+	
+	std::lock_guard<std::mutex> lock( impulse_tables_mutex );
+	
+	blip_impulse_table_* t = acquire_table( new_eq );
+	release_retired();
+	release_impulse_table( prepared.exchange( t, std::memory_order_acq_rel ) );
+}
+
+// Releases tables handed back by take_prepared(). The caller must hold
+// impulse_tables_mutex.
+void Blip_Impulse_::release_retired()
+{
+	for ( int i = 0; i < max_retired; i++ )
+		release_impulse_table( retired [i].exchange( NULL, std::memory_order_acquire ) );
+}
+
+bool Blip_Impulse_::take_prepared()
+{
+	// The old table is never freed here, but handed back through a free
+	// retired slot for the next prepare_eq() to release. Only this thread
+	// fills slots, so one seen empty stays empty.
+	if ( !prepared.load( std::memory_order_relaxed ) )
+		return false;
+	
+	int slot = 0;
+	while ( retired [slot].load( std::memory_order_relaxed ) )
+		if ( ++slot >= max_retired )
+			return false; // can't happen if calls follow the rules above
+	
+	blip_impulse_table_* t = prepared.exchange( NULL, std::memory_order_acquire );
+	if ( !t )
+		return false;
+	
+	retired [slot].store( table, std::memory_order_release );
+	table = t;
+	impulses = t->impulses;
+	eq.treble = t->treble;
+	eq.cutoff = t->cutoff;
+	eq.sample_rate = t->sample_rate;
+	has_eq = true;
+	return true;
+}
+
+static const double pi = 3.1415926535897932384626433832795029L;
+
+// Generates the unscaled impulse for equalization 'eq'
+void Blip_Impulse_::generate( imp_t* imps, const blip_eq_t& eq ) const
+{
 	double treble = pow( 10.0, 1.0 / 20 * eq.treble ); // dB (-6dB = 0.50)
 	if ( treble < 0.000005 )
 		treble = 0.000005;
@@ -305,7 +558,7 @@ void Blip_Impulse_::treble_eq( const blip_eq_t& new_eq )
 	
 	// integrate runs of length 'max_res'
 	double factor = impulse_amp * 0.5 / total; // 0.5 accounts for other mirrored half
-	imp_t* imp = impulse;
+	imp_t* imp = base_impulse( imps );
 	const int step = max_res / res;
 	int offset = res > 1 ? max_res : max_res / 2;
 	for ( int n = res / 2 + 1; n--; offset -= step )
@@ -324,14 +577,6 @@ void Blip_Impulse_::treble_eq( const blip_eq_t& new_eq )
 			*imp++ = (imp_t) floor( sum * factor + (impulse_offset + 0.5) );
 		}
 	}
-	
-	// rescale
-	double unit = volume_unit_;
-	if ( unit >= 0 )
-	{
-		volume_unit_ = -1;
-		volume_unit( unit );
-	}
 }
 
 void Blip_Buffer::remove_samples( long count )
@@ -343,6 +588,17 @@ void Blip_Buffer::remove_samples( long count )
 	
 	remove_silence( count );
 	
+	// Everything past the unread samples and their impulse tails is silence,
+	// so removing samples only has to advance buffer_ over them. They are
+	// cleared once buffer_ has slid as far as it can, when the remaining
+	// samples are moved back to the beginning.
+	long slid = (buffer_ - buffer_begin_) + count;
+	if ( slid <= (long) slide_size_ )
+	{
+		buffer_ += count;
+		return;
+	}
+	
 	// Allows synthesis slightly past time passed to end_frame(), as long as it's
 	// not more than an output sample.
 	// to do: kind of hacky, could add run_until() which keeps track of extra synthesis
@@ -350,11 +606,24 @@ void Blip_Buffer::remove_samples( long count )
 	
 	// copy remaining samples to beginning and clear old samples
 	long remain = samples_avail() + widest_impulse_ + copy_extra;
-	if ( count >= remain )
-		memmove( buffer_, buffer_ + count, remain * sizeof (buf_t_) );
-	else
-		memcpy(  buffer_, buffer_ + count, remain * sizeof (buf_t_) );
-	memset( buffer_ + remain, sample_offset_ & 0xFF, count * sizeof (buf_t_) );
+	memmove( buffer_begin_, buffer_ + count, remain * sizeof (buf_t_) );
+	memset( buffer_begin_ + remain, sample_offset_ & 0xFF, slid * sizeof (buf_t_) );
+	buffer_ = buffer_begin_;
+}
+
+bool Blip_Buffer::settled( int threshold ) const
+{
+	blip_long_t s = reader_accum >> accum_fract;
+	if ( s > threshold || s < -threshold )
+		return false;
+	
+	// unread samples plus the impulse tails that extend past them
+	long count = samples_avail() + widest_impulse_ + 1;
+	for ( long i = 0; i < count; i++ )
+		if ( buffer_ [i] != sample_offset_ )
+			return false;
+	
+	return true;
 }
 
 #include BLARGG_ENABLE_OPTIMIZER
@@ -373,35 +642,33 @@ long Blip_Buffer::read_samples( blip_sample_t* out, long max_samples, bool stere
 	int sample_offset_ = this->sample_offset_;
 	int bass_shift = this->bass_shift;
 	buf_t_* buf = buffer_;
-	long accum = reader_accum;
+	blip_long_t accum = reader_accum;
 	
 	if ( !stereo )
 	{
 		for ( long n = count; n--; )
 		{
-			long s = accum >> accum_fract;
+			blip_long_t s = accum >> accum_fract;
 			accum -= accum >> bass_shift;
-			accum += (long (*buf++) - sample_offset_) << accum_fract;
+			accum += (blip_long_t (*buf++) - sample_offset_) << accum_fract;
 			*out++ = (blip_sample_t) s;
 			
 			// clamp sample
-			if ( (BOOST::int16_t) s != s )
-				out [-1] = blip_sample_t (0x7FFF - (s >> 24));
+			BLIP_CLAMP( s, out [-1] );
 		}
 	}
 	else
 	{
 		for ( long n = count; n--; )
 		{
-			long s = accum >> accum_fract;
+			blip_long_t s = accum >> accum_fract;
 			accum -= accum >> bass_shift;
-			accum += (long (*buf++) - sample_offset_) << accum_fract;
+			accum += (blip_long_t (*buf++) - sample_offset_) << accum_fract;
 			*out = (blip_sample_t) s;
 			out += 2;
 			
 			// clamp sample
-			if ( (BOOST::int16_t) s != s )
-				out [-2] = blip_sample_t (0x7FFF - (s >> 24));
+			BLIP_CLAMP( s, out [-2] );
 		}
 	}
 	
@@ -9,6 +9,8 @@
 
 #include "blargg_common.h"
 
+#include <atomic>
+
 class Blip_Reader;
 
 // Source time unit.
@@ -22,6 +24,27 @@ const int blip_default_length = 0;
 
 typedef unsigned long blip_resampled_time_t; // not documented
 
+// Define BLIP_BUFFER_WIDE to 1 to synthesize into 32-bit samples rather than
+// 16-bit ones. Any number of synths can then add to the same buffer without
+// wrapping around, and Stereo_Buffer's float output is no longer clamped to
+// 16 bits. Impulse tables are the same either way, and so is the output of a
+// buffer which never wraps around or clamps.
+#ifndef BLIP_BUFFER_WIDE
+	#define BLIP_BUFFER_WIDE 0
+#endif
+
+// Integrated sample level, before it is clamped to blip_sample_t (not documented)
+#if BLIP_BUFFER_WIDE
+	typedef BOOST::int64_t blip_long_t;
+#else
+	typedef long blip_long_t;
+#endif
+
+// Clamp sample to 16 bits (not documented)
+#define BLIP_CLAMP( sample, out ) \
+	{ if ( (blip_sample_t) (sample) != (sample) ) \
+		out = blip_sample_t (0x7FFF ^ ((sample) >> (sizeof (sample) * 8 - 1))); }
+
 class Blip_Buffer {
 public:
 	// Construct an empty buffer.
@@ -47,6 +70,14 @@ public:
 	// Set frequency at which high-pass filter attenuation passes -3dB
 	void bass_freq( int frequency );
 	
+	// Same as bass_freq( frequency ), given bass_shift_for( sample_rate(), frequency ).
+	// Does no floating-point math, so bass can be changed from a real-time thread
+	// with the shift calculated elsewhere.
+	void bass_freq( int frequency, int shift );
+	
+	// Shift the high-pass filter uses for 'frequency' at 'sample_rate'
+	static int bass_shift_for( long sample_rate, int frequency );
+	
 	// Remove all available samples and clear buffer to silence. If 'entire_buffer' is
 	// false, just clear out any samples waiting rather than the entire buffer.
 	void clear( bool entire_buffer = true );
@@ -72,6 +103,11 @@ public:
 	// Number of samples delay from synthesis to samples read out
 	int output_latency() const;
 	
+	// True if no transitions are left in the buffer and the output has decayed
+	// to within 'threshold' of silence, so reading more samples would only
+	// produce (near) silence.
+	bool settled( int threshold = 1 ) const;
+	
 // Beta features
 	
 	// Number of raw samples that can be mixed within frame of specified duration
@@ -109,16 +145,23 @@ private:
 
 	// Don't use the following members. They are public only for technical reasons.
 	public:
+	#if BLIP_BUFFER_WIDE
+		enum { sample_offset_ = 0 };
+		typedef BOOST::int32_t buf_t_;
+	#else
 		enum { sample_offset_ = 0x7F7F }; // repeated byte allows memset to clear buffer
-		enum { widest_impulse_ = 24 };
 		typedef BOOST::uint16_t buf_t_;
+	#endif
+		enum { widest_impulse_ = 24 };
 		
 		unsigned long factor_;
 		blip_resampled_time_t offset_;
-		buf_t_* buffer_;
+		buf_t_* buffer_; // next unread sample, slides forward through buffer_begin_
 		unsigned buffer_size_;
 	private:
-		long reader_accum;
+		buf_t_* buffer_begin_;
+		unsigned slide_size_;
+		blip_long_t reader_accum;
 		int bass_shift;
 		long samples_per_sec;
 		long clocks_per_sec;
@@ -145,7 +188,7 @@ private:
 // not documented yet (see Multi_Buffer.cpp for an example of use)
 class Blip_Reader {
 	const Blip_Buffer::buf_t_* buf;
-	long accum;
+	blip_long_t accum;
 	#ifdef __MWERKS__
 	void operator = ( struct foobar ); // helps optimizer
 	#endif
@@ -158,13 +201,13 @@ public:
 		return blip_buf.bass_shift;
 	}
 	
-	int read() const {
-		return int (accum >> Blip_Buffer::accum_fract);
+	blip_long_t read() const {
+		return accum >> Blip_Buffer::accum_fract;
 	}
 	
 	void next( int bass_shift = 9 ) {
 		accum -= accum >> bass_shift;
-		accum += ((long) *buf++ - Blip_Buffer::sample_offset_) << Blip_Buffer::accum_fract;
+		accum += ((blip_long_t) *buf++ - Blip_Buffer::sample_offset_) << Blip_Buffer::accum_fract;
 	}
 	
 	void end( Blip_Buffer& blip_buf ) {
@@ -184,27 +227,67 @@ const int blip_res_bits_ = 5;
 
 typedef BOOST::uint32_t blip_pair_t_;
 
+struct blip_impulse_table_;
+
+// Impulse tables are generated once per combination of width, resolution,
+// fine bits, equalization and volume unit, and shared read-only by every
+// synth in the process that uses the same settings.
 class Blip_Impulse_ {
 	typedef BOOST::uint16_t imp_t;
 	
 	blip_eq_t eq;
 	double  volume_unit_;
-	imp_t*  impulses;
-	imp_t*  impulse;
+	blip_impulse_table_* table;
+	long    size;
 	int     width;
 	int     fine_bits;
 	int     res;
-	bool    generate;
+	bool    has_eq;
+	
+	imp_t* base_impulse( imp_t* ) const;
+	void generate( imp_t*, const blip_eq_t& ) const;
+	void fine_volume_unit( imp_t*, BOOST::uint32_t offset ) const;
+	void scale_impulse( int unit, imp_t* base, imp_t* out ) const;
+	void update();
+	blip_impulse_table_* acquire_table( const blip_eq_t& ) const;
+	
+	// set by prepare_eq(), and taken by take_prepared() in exchange for the
+	// table it replaces, which the next prepare_eq() releases. Between two
+	// prepare_eq() calls at most two tables are taken, the one still waiting
+	// from the previous call and the one it publishes, so two slots mean a
+	// take never has to wait for one to be released.
+	enum { max_retired = 2 };
+	std::atomic<blip_impulse_table_*> prepared;
+	std::atomic<blip_impulse_table_*> retired [max_retired];
+	void release_retired();
 	
-	void fine_volume_unit();
-	void scale_impulse( int unit, imp_t* ) const;
+	// noncopyable
+	Blip_Impulse_& operator = ( const Blip_Impulse_& );
 public:
+	const blip_pair_t_* impulses; // shared, NULL until volume is set
 	Blip_Buffer*    buf;
 	BOOST::uint32_t offset;
 	
-	void init( blip_pair_t_* impulses, int width, int res, int fine_bits = 0 );
+	Blip_Impulse_( int width, int res, int fine_bits, long size );
+	Blip_Impulse_( const Blip_Impulse_& );
+	~Blip_Impulse_();
 	void volume_unit( double );
 	void treble_eq( const blip_eq_t& );
+	
+	// Generate impulses for 'eq' on a thread other than the one using the synth,
+	// for take_prepared() to switch to. Volume must already be set, and calls
+	// must not overlap each other or volume_unit() and treble_eq(), which drop
+	// impulses that haven't been taken yet.
+	void prepare_eq( const blip_eq_t& );
+	
+	// Switch to the impulses from the latest prepare_eq(), if any are waiting.
+	// Doesn't lock, allocate or free memory, or do floating-point math.
+	bool take_prepared();
+	
+	// Number of distinct impulse tables currently cached, and their total size
+	// in bytes
+	static int  shared_tables();
+	static long shared_bytes();
 };
 
 inline blip_eq_t::blip_eq_t( double t ) :
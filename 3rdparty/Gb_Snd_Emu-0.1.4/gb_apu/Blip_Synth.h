@@ -38,20 +38,26 @@ class Blip_Synth {
 		res = 1 << blip_res_bits_,
 		impulse_size = width / 2 * (fine_mode + 1),
 		base_impulses_size = width / 2 * (res / 2 + 1),
+		impulses_size = impulse_size * res * 2 + base_impulses_size, // shared table
 		fine_bits = (fine_mode ? (abs_range <= 64 ? 2 : abs_range <= 128 ? 3 :
 			abs_range <= 256 ? 4 : abs_range <= 512 ? 5 : abs_range <= 1024 ? 6 :
 			abs_range <= 2048 ? 7 : 8) : 0)
 	};
-	blip_pair_t_  impulses [impulse_size * res * 2 + base_impulses_size];
 	Blip_Impulse_ impulse;
-	void init() { impulse.init( impulses, width, res, fine_bits ); }
 public:
-	Blip_Synth()                            { init(); }
-	Blip_Synth( double volume )             { init(); this->volume( volume ); }
+	Blip_Synth() : impulse( width, res, fine_bits, impulses_size ) { }
+	Blip_Synth( double volume ) : impulse( width, res, fine_bits, impulses_size ) { this->volume( volume ); }
 	
 	// Configure low-pass filter (see notes.txt). Not optimized for real-time control
 	void treble_eq( const blip_eq_t& eq )   { impulse.treble_eq( eq ); }
 	
+	// Real-time control of the low-pass filter: prepare_treble_eq() generates the
+	// impulse on another thread, and take_prepared_eq() switches to it from the
+	// thread using the synth, without locking, allocating or floating-point math.
+	// Returns false if nothing was prepared since the last switch.
+	void prepare_treble_eq( const blip_eq_t& eq )   { impulse.prepare_eq( eq ); }
+	bool take_prepared_eq()                         { return impulse.take_prepared(); }
+	
 	// Set volume of a transition at amplitude 'range' by setting volume_unit
 	// to v / range
 	void volume( double v )                 { impulse.volume_unit( v * (1.0 / abs_range) ); }
@@ -136,6 +142,42 @@ void Blip_Wave<quality,range>::amplitude( int amp ) {
 	synth.offset_inline( time_, delta );
 }
 
+#if BLIP_BUFFER_WIDE
+
+// Wide buffers add each 16-bit point of the impulse to its own 32-bit sample.
+// Every point carries a bias of one volume unit (of each of the two tables in
+// fine mode), which is subtracted rather than left to wrap around. The loops
+// have no dependencies between samples, so compilers vectorize them as is.
+template<int width,int fine_bits>
+inline void blip_add_impulse_wide_( Blip_Buffer::buf_t_* buf, const BOOST::uint16_t* imp,
+		int delta, blip_pair_t_ unit )
+{
+	typedef BOOST::int32_t sample_t;
+	
+	if ( !fine_bits )
+	{
+		blip_pair_t_ const bias = unit * delta;
+		for ( int i = 0; i < width; i++ )
+			buf [i] += sample_t (imp [i] * blip_pair_t_ (delta) - bias);
+	}
+	else
+	{
+		enum { sub_range = 1 << fine_bits };
+		delta += sub_range / 2;
+		int delta2 = (delta & (sub_range - 1)) - sub_range / 2;
+		delta >>= fine_bits;
+		
+		blip_pair_t_ const bias = unit * delta2 + (unit << fine_bits) * delta;
+		for ( int i = 0; i < width; i += 2, imp += 4 )
+		{
+			buf [i]     += sample_t (imp [0] * blip_pair_t_ (delta2) + imp [2] * blip_pair_t_ (delta) - bias);
+			buf [i + 1] += sample_t (imp [1] * blip_pair_t_ (delta2) + imp [3] * blip_pair_t_ (delta) - bias);
+		}
+	}
+}
+
+#endif
+
 template<int quality,int range>
 inline void Blip_Synth<quality,range>::offset_resampled( blip_resampled_time_t time,
 		int delta, Blip_Buffer* blip_buf ) const
@@ -146,11 +188,16 @@ inline void Blip_Synth<quality,range>::offset_resampled( blip_resampled_time_t t
 	assert(( "Blip_Synth/Blip_wave: Went past end of buffer",
 			sample_index < blip_buf->buffer_size_ ));
 	enum { const_offset = Blip_Buffer::widest_impulse_ / 2 - width / 2 };
-	pair_t* buf = (pair_t*) &blip_buf->buffer_ [const_offset + sample_index];
 	
 	enum { shift = BLIP_BUFFER_ACCURACY - blip_res_bits_ };
 	enum { mask = res * 2 - 1 };
-	const pair_t* imp = &impulses [((time >> shift) & mask) * impulse_size];
+	const pair_t* imp = &impulse.impulses [((time >> shift) & mask) * impulse_size];
+	
+#if BLIP_BUFFER_WIDE
+	blip_add_impulse_wide_<width,fine_bits>( &blip_buf->buffer_ [const_offset + sample_index],
+			(const BOOST::uint16_t*) imp, delta, impulse.offset & 0xffff );
+#else
+	pair_t* buf = (pair_t*) &blip_buf->buffer_ [const_offset + sample_index];
 	
 	pair_t offset = impulse.offset * delta;
 	
@@ -197,6 +244,7 @@ inline void Blip_Synth<quality,range>::offset_resampled( blip_resampled_time_t t
 			buf += 2;
 		}
 	}
+#endif
 }
 
 template<int quality,int range>
@@ -20,17 +20,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
 
 Gb_Apu::Gb_Apu()
 {
-	square1.synth = &square_synth;
-	square2.synth = &square_synth;
+	square1.synths = &square_synths;
+	square2.synths = &square_synths;
 	square1.has_sweep = true;
-	wave.synth  = &other_synth;
-	noise.synth = &other_synth;
+	wave.synths  = &other_synths;
+	noise.synths = &other_synths;
 	
 	oscs [0] = &square1;
 	oscs [1] = &square2;
 	oscs [2] = &wave;
 	oscs [3] = &noise;
 	
+	synth_quality = gb_normal_quality;
+	
 	volume( 1.0 );
 	reset();
 }
@@ -39,17 +41,39 @@ Gb_Apu::~Gb_Apu()
 {
 }
 
+void Gb_Apu::skip_ultrasonic( bool skip )
+{
+	square1.skip_ultrasonic = skip;
+	square2.skip_ultrasonic = skip;
+	wave.skip_ultrasonic = skip;
+}
+
+void Gb_Apu::quality( int q )
+{
+	require( gb_draft_quality <= q && q <= gb_ultra_quality );
+	
+	synth_quality = q;
+	for ( int i = 0; i < osc_count; i++ )
+		oscs [i]->quality = q;
+}
+
 void Gb_Apu::treble_eq( const blip_eq_t& eq )
 {
-	square_synth.treble_eq( eq );
-	other_synth.treble_eq( eq );
+	square_synths.treble_eq( eq );
+	other_synths.treble_eq( eq );
+}
+
+void Gb_Apu::prepare_treble_eq( const blip_eq_t& eq )
+{
+	square_synths.prepare_treble_eq( eq );
+	other_synths.prepare_treble_eq( eq );
 }
 
 void Gb_Apu::volume( double vol )
 {
 	vol *= 0.60 / osc_count;
-	square_synth.volume( vol );
-	other_synth.volume( vol );
+	square_synths.volume( vol );
+	other_synths.volume( vol );
 }
 
 void Gb_Apu::output( Blip_Buffer* center, Blip_Buffer* left, Blip_Buffer* right )
@@ -95,33 +119,32 @@ void Gb_Apu::osc_output( int index, Blip_Buffer* center, Blip_Buffer* left, Blip
 	osc.output = osc.outputs [osc.output_select];
 }
 
-void Gb_Apu::run_until( gb_time_t end_time )
+// Run the oscillators with bit n of 'channels' set up to end_time, through
+// their concrete types, so the calls aren't virtual and the others compile out
+template<int channels>
+void Gb_Apu::run_channels( gb_time_t end_time )
 {
-	require( end_time >= last_time ); // end_time must not be before previous time
-	if ( end_time == last_time )
-		return;
-	
 	while ( true )
 	{
+		// oscillators run straight through ticks that wouldn't change them
+		if ( next_frame_time < end_time && frame_sequencer_idle() )
+			skip_frames( end_time );
+		
 		gb_time_t time = next_frame_time;
 		if ( time > end_time )
 			time = end_time;
 		
 		// run oscillators
-		for ( int i = 0; i < osc_count; ++i ) {
-			Gb_Osc& osc = *oscs [i];
-			if ( osc.output ) {
-				if ( osc.output != osc.outputs [3] )
-					stereo_found = true;
-				osc.run( last_time, time );
-			}
-		}
+		if ( channels & 1 ) square1.Gb_Square::run( last_time, time );
+		if ( channels & 2 ) square2.Gb_Square::run( last_time, time );
+		if ( channels & 4 ) wave.Gb_Wave::run( last_time, time );
+		if ( channels & 8 ) noise.Gb_Noise::run( last_time, time );
 		last_time = time;
 		
 		if ( time == end_time )
 			break;
 		
-		next_frame_time += 4194304 / 256; // 256 Hz
+		next_frame_time += frame_period;
 		
 		// 256 Hz actions
 		square1.clock_length();
@@ -142,11 +165,73 @@ void Gb_Apu::run_until( gb_time_t end_time )
 	}
 }
 
+// True if no frame sequencer action can change any oscillator's output. That
+// stays true until a register is written, as only actions could change it.
+bool Gb_Apu::frame_sequencer_idle() const
+{
+	return !square1.length_counting() && !square2.length_counting() &&
+			!wave.length_counting() && !noise.length_counting() &&
+			!square1.envelope_changing() && !square2.envelope_changing() &&
+			!noise.envelope_changing() && !square1.sweep_active();
+}
+
+// Pass every frame sequencer tick before end_time while it is idle
+void Gb_Apu::skip_frames( gb_time_t end_time )
+{
+	int count = int ((end_time - next_frame_time + frame_period - 1) / frame_period);
+	next_frame_time += gb_time_t (count) * frame_period;
+	
+	// envelopes are clocked on ticks that bring frame_count back to 0
+	int envelope_clocks = (frame_count + count) >> 2;
+	frame_count = (frame_count + count) & 3;
+	square1.skip_envelope( envelope_clocks );
+	square2.skip_envelope( envelope_clocks );
+	noise.skip_envelope( envelope_clocks );
+}
+
+void Gb_Apu::run_until( gb_time_t end_time )
+{
+	require( end_time >= last_time ); // end_time must not be before previous time
+	if ( end_time == last_time )
+		return;
+	
+	// outputs only change at register writes, which run up to their time
+	// first, so which oscillators run is the same for the whole call
+	int channels = 0;
+	for ( int i = 0; i < osc_count; i++ )
+	{
+		const Gb_Osc& osc = *oscs [i];
+		if ( osc.output )
+		{
+			channels |= 1 << i;
+			if ( osc.output != osc.outputs [3] )
+				stereo_found = true;
+		}
+	}
+	
+	typedef void (Gb_Apu::*runner_t)( gb_time_t );
+	static const runner_t runners [1 << osc_count] = {
+		&Gb_Apu::run_channels<0>,  &Gb_Apu::run_channels<1>,
+		&Gb_Apu::run_channels<2>,  &Gb_Apu::run_channels<3>,
+		&Gb_Apu::run_channels<4>,  &Gb_Apu::run_channels<5>,
+		&Gb_Apu::run_channels<6>,  &Gb_Apu::run_channels<7>,
+		&Gb_Apu::run_channels<8>,  &Gb_Apu::run_channels<9>,
+		&Gb_Apu::run_channels<10>, &Gb_Apu::run_channels<11>,
+		&Gb_Apu::run_channels<12>, &Gb_Apu::run_channels<13>,
+		&Gb_Apu::run_channels<14>, &Gb_Apu::run_channels<15>
+	};
+	(this->*runners [channels])( end_time );
+}
+
 bool Gb_Apu::end_frame( gb_time_t end_time )
 {
 	if ( end_time > last_time )
 		run_until( end_time );
 	
+	// switch equalization between frames, so each frame uses one impulse
+	square_synths.take_prepared_eq();
+	other_synths.take_prepared_eq();
+	
 	assert( next_frame_time >= end_time );
 	next_frame_time -= end_time;
 	
@@ -158,6 +243,13 @@ bool Gb_Apu::end_frame( gb_time_t end_time )
 	return result;
 }
 
+// Unpack wave RAM byte 'index' into the two samples it holds
+inline void Gb_Apu::write_wave( int index, int data )
+{
+	wave.wave [index * 2] = data >> 4;
+	wave.wave [index * 2 + 1] = data & 0x0f;
+}
+
 void Gb_Apu::write_register( gb_time_t time, gb_addr_t addr, int data )
 {
 	require( (unsigned) data < 0x100 );
@@ -193,7 +285,7 @@ void Gb_Apu::write_register( gb_time_t time, gb_addr_t addr, int data )
 					{
 						int new_amp = osc.last_amp * global_volume / osc.global_volume;
 						if ( osc.output )
-							square_synth.offset( time, new_amp - osc.last_amp, osc.output );
+							square_synths.offset( synth_quality, time, new_amp - osc.last_amp, osc.output );
 						osc.last_amp = new_amp;
 					}
 					any_enabled |= osc.volume;
@@ -202,7 +294,7 @@ void Gb_Apu::write_register( gb_time_t time, gb_addr_t addr, int data )
 			}
 			
 			if ( !any_enabled && square1.outputs [3] )
-				square_synth.offset( time, (global_volume - old_volume) * 15 * 2, square1.outputs [3] );
+				square_synths.offset( synth_quality, time, (global_volume - old_volume) * 15 * 2, square1.outputs [3] );
 		}
 	}
 	
@@ -223,19 +315,26 @@ void Gb_Apu::write_register( gb_time_t time, gb_addr_t addr, int data )
 			if ( osc.output != old_output && osc.last_amp )
 			{
 				if ( old_output )
-					square_synth.offset( time, -osc.last_amp, old_output );
+					square_synths.offset( synth_quality, time, -osc.last_amp, old_output );
 				osc.last_amp = 0;
 			}
 		}
 	}
-	else if ( addr >= 0xff30 )
+	else if ( addr >= wave_ram_addr )
 	{
-		int index = (addr & 0x0f) * 2;
-		wave.wave [index] = data >> 4;
-		wave.wave [index + 1] = data & 0x0f;
+		write_wave( addr - wave_ram_addr, data );
 	}
 }
 
+void Gb_Apu::write_wave_ram( gb_time_t time, const BOOST::uint8_t* data )
+{
+	run_until( time );
+	
+	memcpy( regs + (wave_ram_addr - start_addr), data, wave_ram_size );
+	for ( int i = 0; i < wave_ram_size; i++ )
+		write_wave( i, data [i] );
+}
+
 int Gb_Apu::read_register( gb_time_t time, gb_addr_t addr )
 {
 	// function now takes actual address, i.e. 0xFFXX
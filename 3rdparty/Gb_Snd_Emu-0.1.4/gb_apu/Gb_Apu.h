@@ -22,6 +22,12 @@ public:
 	// Set treble equalization
 	void treble_eq( const blip_eq_t& );
 	
+	// Same as treble_eq(), but can be called while another thread runs the APU.
+	// The impulses are generated on the calling thread and switched to at the
+	// next end_frame(), which doesn't lock, allocate or do floating-point math
+	// for it. Calls must not overlap each other or treble_eq().
+	void prepare_treble_eq( const blip_eq_t& );
+	
 	// Reset oscillators and internal state
 	void reset();
 	
@@ -48,12 +54,37 @@ public:
 	// Read from address at specified time
 	int read_register( gb_time_t, gb_addr_t );
 	
+	// Same as writing the 16 bytes of 'data' to wave RAM at 0xff30 to 0xff3f,
+	// all at the specified time, but the oscillators are only run up to it once
+	enum { wave_ram_addr = 0xff30 };
+	enum { wave_ram_size = 16 };
+	void write_wave_ram( gb_time_t, const BOOST::uint8_t data [wave_ram_size] );
+	
 	// Run all oscillators up to specified time, end current time frame, then
 	// start a new frame at time 0. Return true if any oscillators added
 	// sound to one of the left/right buffers, false if they only added
 	// to the center buffer.
 	bool end_frame( gb_time_t );
 	
+	// True if no oscillator is currently adding anything to its output
+	// buffers. Useful for skipping an idle chip entirely.
+	bool silent() const;
+	
+	// If true, squares and wave whose waveform repeats above the output sample
+	// rate's Nyquist frequency add their average level rather than transitions
+	// the band-limited synthesis would filter out anyway. Off by default.
+	void skip_ultrasonic( bool );
+	
+	// Number of transitions skip_ultrasonic() has skipped since reset()
+	long skipped_transitions() const;
+	
+	// Set synthesis quality to gb_draft_quality, gb_normal_quality (the default),
+	// gb_high_quality or gb_ultra_quality. Each tier uses a wider impulse than the
+	// one before it, for flatter treble and less aliasing at more CPU cost. Every
+	// tier's impulses are set up in advance, and transitions already added keep
+	// theirs, so quality can be changed between any two frames without a click.
+	void quality( int );
+	
 private:
 	// noncopyable
 	Gb_Apu( const Gb_Apu& );
@@ -64,21 +95,44 @@ private:
 	gb_time_t   last_time;
 	int         frame_count;
 	bool        stereo_found;
+	enum { frame_period = 4194304 / 256 }; // 256 Hz
 	
 	Gb_Square   square1;
 	Gb_Square   square2;
 	Gb_Wave     wave;
 	Gb_Noise    noise;
 	BOOST::uint8_t regs [register_count];
-	Gb_Square::Synth square_synth; // shared between squares
-	Gb_Wave::Synth   other_synth;  // shared between wave and noise
+	Gb_Square::Synths square_synths; // shared between squares
+	Gb_Wave::Synths   other_synths;  // shared between wave and noise
+	int               synth_quality;
 	
 	void run_until( gb_time_t );
+	bool frame_sequencer_idle() const;
+	void skip_frames( gb_time_t );
+	template<int channels>
+	void run_channels( gb_time_t );
+	void write_wave( int index, int data );
 };
 
 inline void Gb_Apu::output( Blip_Buffer* b ) { output( b, nullptr, nullptr ); }
 	
 inline void Gb_Apu::osc_output( int i, Blip_Buffer* b ) { osc_output( i, b, nullptr, nullptr ); }
 
+inline long Gb_Apu::skipped_transitions() const
+{
+	long n = 0;
+	for ( int i = 0; i < osc_count; i++ )
+		n += oscs [i]->skipped;
+	return n;
+}
+
+inline bool Gb_Apu::silent() const
+{
+	for ( int i = 0; i < osc_count; i++ )
+		if ( oscs [i]->last_amp )
+			return false;
+	return true;
+}
+
 #endif
 
@@ -0,0 +1,75 @@
+// Summing bus which mixes several Gb_Apu into one shared Stereo_Buffer
+
+// Added for PAPU. GNU LGPL license, same as the rest of Gb_Snd_Emu.
+
+#ifndef GB_APU_BUS_H
+#define GB_APU_BUS_H
+
+#include "Gb_Apu.h"
+#include "Multi_Buffer.h"
+
+// Band-limited synthesis is linear, so any number of chips can add their
+// transitions to the same Blip_Buffers. The bus keeps their time frames in
+// step, and the buffer's integration, filtering and clamping then runs once
+// per sample no matter how many chips are mixed.
+class Gb_Apu_Bus {
+public:
+	Gb_Apu_Bus();
+
+	enum { max_apus = 32 };
+
+	// Buffer all chips on the bus add to. Set its sample rate, clock rate and
+	// bass frequency as usual and read the mix from it.
+	Stereo_Buffer& buffer()             { return buf; }
+	const Stereo_Buffer& buffer() const { return buf; }
+
+	// Route apu's output into the bus
+	void attach( Gb_Apu& );
+
+	// Have apu's time frame ended along with the next end_frame(). Call once per
+	// frame for each chip that was written to or is still sounding; any chip
+	// left out isn't run at all and must not have been written to this frame.
+	void add_to_frame( Gb_Apu& );
+
+	// Run every chip added since the last call up to 'time', end their frames and
+	// the buffer's, then start a new frame at time 0. 'time' must not be earlier
+	// than any register write made during the frame. Return true if any chip
+	// added stereo sound.
+	bool end_frame( gb_time_t );
+
+private:
+	// noncopyable
+	Gb_Apu_Bus( const Gb_Apu_Bus& );
+	Gb_Apu_Bus& operator = ( const Gb_Apu_Bus& );
+
+	Stereo_Buffer buf;
+	Gb_Apu* frame_apus [max_apus];
+	int frame_apu_count;
+};
+
+inline Gb_Apu_Bus::Gb_Apu_Bus() : frame_apu_count( 0 ) { }
+
+inline void Gb_Apu_Bus::attach( Gb_Apu& apu )
+{
+	apu.output( buf.center(), buf.left(), buf.right() );
+}
+
+inline void Gb_Apu_Bus::add_to_frame( Gb_Apu& apu )
+{
+	assert( frame_apu_count < max_apus );
+	frame_apus [frame_apu_count++] = &apu;
+}
+
+inline bool Gb_Apu_Bus::end_frame( gb_time_t time )
+{
+	bool stereo = false;
+	for ( int i = 0; i < frame_apu_count; i++ )
+		stereo |= frame_apus [i]->end_frame( time );
+	frame_apu_count = 0;
+
+	buf.end_frame( time, stereo );
+	return stereo;
+}
+
+#endif
+
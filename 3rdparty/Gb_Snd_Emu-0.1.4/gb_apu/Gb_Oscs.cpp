@@ -20,6 +20,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
 
 const int trigger = 0x80;
 
+// Run osc with the synth for its quality tier
+template<class Osc>
+static inline void run_at_quality( Osc& osc, gb_time_t time, gb_time_t end_time )
+{
+	switch ( osc.quality )
+	{
+		case gb_draft_quality: osc.run_tier( time, end_time, osc.synths->draft ); break;
+		case gb_high_quality:  osc.run_tier( time, end_time, osc.synths->high ); break;
+		case gb_ultra_quality: osc.run_tier( time, end_time, osc.synths->ultra ); break;
+		default:               osc.run_tier( time, end_time, osc.synths->normal ); break;
+	}
+}
+
 // Gb_Osc
 
 Gb_Osc::Gb_Osc()
@@ -29,6 +42,9 @@ Gb_Osc::Gb_Osc()
 	outputs [1] = nullptr;
 	outputs [2] = nullptr;
 	outputs [3] = nullptr;
+	skip_ultrasonic = false;
+	skipped = 0;
+	quality = gb_normal_quality;
 }
 
 void Gb_Osc::reset()
@@ -42,6 +58,7 @@ void Gb_Osc::reset()
 	length = 0;
 	enabled = false;
 	length_enabled = false;
+	skipped = 0;
 	output_select = 3;
 	output = outputs [output_select];
 }
@@ -90,6 +107,21 @@ void Gb_Env::clock_envelope()
 	}
 }
 
+void Gb_Env::skip_envelope( int count )
+{
+	// env_delay counts down and reloads from env_period, the only state that changes
+	if ( !env_delay || !count )
+		return;
+	
+	if ( count < env_delay ) {
+		env_delay -= count;
+	}
+	else {
+		count -= env_delay;
+		env_delay = env_period ? env_period - count % env_period : 0;
+	}
+}
+
 void Gb_Env::write_register( int reg, int value )
 {
 	if ( reg == 2 ) {
@@ -197,6 +229,12 @@ void Gb_Square::write_register( int reg, int value )
 }
 
 void Gb_Square::run( gb_time_t time, gb_time_t end_time )
+{
+	run_at_quality( *this, time, end_time );
+}
+
+template<class Tier>
+void Gb_Square::run_tier( gb_time_t time, gb_time_t end_time, const Tier& synth )
 {
 	// to do: when frequency goes above 20000 Hz output should actually be 1/2 volume
 	// rather than 0
@@ -206,7 +244,7 @@ void Gb_Square::run( gb_time_t time, gb_time_t end_time )
 	{
 		if ( last_amp )
 		{
-			synth->offset( time, -last_amp, output );
+			synth.offset( time, -last_amp, output );
 			last_amp = 0;
 		}
 		delay = 0;
@@ -215,18 +253,43 @@ void Gb_Square::run( gb_time_t time, gb_time_t end_time )
 	{
 		int amp = (phase < duty) ? volume : -volume;
 		amp *= global_volume;
+		
+		// above the Nyquist frequency only the duty-weighted average is heard
+		const bool ultrasonic = this->ultrasonic( period * 8 );
+		if ( ultrasonic )
+			amp = volume * global_volume * (duty - 4) / 4;
+		
 		if ( amp != last_amp )
 		{
-			synth->offset( time, amp - last_amp, output );
+			synth.offset( time, amp - last_amp, output );
 			last_amp = amp;
 		}
 		
 		time += delay;
-		if ( time < end_time )
+		if ( time < end_time && ultrasonic )
+		{
+			// advance phase as if the transitions had been made
+			long steps = (end_time - time + period - 1) / period;
+			time += steps * period;
+			skipped += steps / 8 * 2;
+			for ( int n = int (steps % 8); n; n-- )
+			{
+				phase = (phase + 1) & 7;
+				if ( phase == 0 || phase == duty )
+					skipped++;
+			}
+		}
+		else if ( time < end_time )
 		{
+			// locals, so they stay in registers across the synth calls
 			Blip_Buffer* const output = this->output;
+			const int period = this->period;
 			const int duty = this->duty;
 			int phase = this->phase;
+			// keep parallel resampled time to eliminate multiplication in the loop
+			const blip_resampled_time_t resampled_period =
+					output->resampled_duration( period );
+			blip_resampled_time_t resampled_time = output->resampled_time( time );
 			amp *= 2;
 			do
 			{
@@ -234,9 +297,10 @@ void Gb_Square::run( gb_time_t time, gb_time_t end_time )
 				if ( phase == 0 || phase == duty )
 				{
 					amp = -amp;
-					synth->offset_inline( time, amp, output );
+					synth.offset_resampled( resampled_time, amp, output );
 				}
 				time += period;
+				resampled_time += resampled_period;
 			}
 			while ( time < end_time );
 			
@@ -301,13 +365,19 @@ void Gb_Wave::write_register( int reg, int value )
 }
 
 void Gb_Wave::run( gb_time_t time, gb_time_t end_time )
+{
+	run_at_quality( *this, time, end_time );
+}
+
+template<class Tier>
+void Gb_Wave::run_tier( gb_time_t time, gb_time_t end_time, const Tier& synth )
 {
 	// to do: when frequency goes above 20000 Hz output should actually be 1/2 volume
 	// rather than 0
 	if ( !enabled || (!length && length_enabled) || !volume || !frequency || period < 7 )
 	{
 		if ( last_amp ) {
-			synth->offset( time, -last_amp, output );
+			synth.offset( time, -last_amp, output );
 			last_amp = 0;
 		}
 		delay = 0;
@@ -316,20 +386,56 @@ void Gb_Wave::run( gb_time_t time, gb_time_t end_time )
 	{
 		int const vol_factor = global_volume * 2;
 		
+		// above the Nyquist frequency only the average of wave RAM is heard
+		const bool ultrasonic = this->ultrasonic( period * wave_size );
+		int amp = (wave [wave_pos] >> volume_shift) * vol_factor;
+		int cycle_changes = 0;
+		if ( ultrasonic )
+		{
+			int sum = 0;
+			for ( int i = 0; i < wave_size; i++ )
+			{
+				int sample = wave [i] >> volume_shift;
+				sum += sample;
+				cycle_changes += sample != wave [(i + 1) % wave_size] >> volume_shift;
+			}
+			amp = sum * vol_factor / wave_size;
+		}
+		
 		// wave data or shift may have changed
-		int diff = (wave [wave_pos] >> volume_shift) * vol_factor - last_amp;
+		int diff = amp - last_amp;
 		if ( diff )
 		{
 			last_amp += diff;
-			synth->offset( time, diff, output );
+			synth.offset( time, diff, output );
 		}
 		
 		time += delay;
-		if ( time < end_time )
+		if ( time < end_time && ultrasonic )
+		{
+			// advance position as if the transitions had been made
+			long steps = (end_time - time + period - 1) / period;
+			time += steps * period;
+			skipped += steps / wave_size * cycle_changes;
+			for ( int n = int (steps % wave_size); n; n-- )
+			{
+				unsigned next = (wave_pos + 1) % wave_size;
+				skipped += wave [next] >> volume_shift != wave [wave_pos] >> volume_shift;
+				wave_pos = next;
+			}
+		}
+		else if ( time < end_time )
 		{
 			int const volume_shift = this->volume_shift;
-		 	int wave_pos = this->wave_pos;
-		 	
+			Blip_Buffer* const output = this->output;
+			const int period = this->period;
+			int wave_pos = this->wave_pos;
+			int last_amp = this->last_amp;
+			// keep parallel resampled time to eliminate multiplication in the loop
+			const blip_resampled_time_t resampled_period =
+					output->resampled_duration( period );
+			blip_resampled_time_t resampled_time = output->resampled_time( time );
+			
 			do
 			{
 				wave_pos = unsigned (wave_pos + 1) % wave_size;
@@ -338,13 +444,15 @@ void Gb_Wave::run( gb_time_t time, gb_time_t end_time )
 				if ( delta )
 				{
 					last_amp = amp;
-					synth->offset_inline( time, delta, output );
+					synth.offset_resampled( resampled_time, delta, output );
 				}
 				time += period;
+				resampled_time += resampled_period;
 			}
 			while ( time < end_time );
 			
 			this->wave_pos = wave_pos;
+			this->last_amp = last_amp;
 		}
 		delay = int (time - end_time);
 	}
@@ -397,10 +505,16 @@ void Gb_Noise::write_register( int reg, int value )
 #include BLARGG_ENABLE_OPTIMIZER
 
 void Gb_Noise::run( gb_time_t time, gb_time_t end_time )
+{
+	run_at_quality( *this, time, end_time );
+}
+
+template<class Tier>
+void Gb_Noise::run_tier( gb_time_t time, gb_time_t end_time, const Tier& synth )
 {
 	if ( !enabled || (!length && length_enabled) || !volume ) {
 		if ( last_amp ) {
-			synth->offset( time, -last_amp, output );
+			synth.offset( time, -last_amp, output );
 			last_amp = 0;
 		}
 		delay = 0;
@@ -410,7 +524,7 @@ void Gb_Noise::run( gb_time_t time, gb_time_t end_time )
 		int amp = bits & 1 ? -volume : volume;
 		amp *= global_volume;
 		if ( amp != last_amp ) {
-			synth->offset( time, amp - last_amp, output );
+			synth.offset( time, amp - last_amp, output );
 			last_amp = amp;
 		}
 		
@@ -422,25 +536,29 @@ void Gb_Noise::run( gb_time_t time, gb_time_t end_time )
 			const blip_resampled_time_t resampled_period =
 					output->resampled_duration( period );
 			blip_resampled_time_t resampled_time = output->resampled_time( time );
-			const unsigned mask = ~(1u << tap);
+			const int period = this->period;
+			const int tap = this->tap;
 			unsigned bits = this->bits;
 			amp *= 2;
 			
+			// step the LFSR up to tap times at once and only visit the steps
+			// where the level changes
+			long steps = (end_time - time + period - 1) / period;
+			time += steps * period;
 			do {
-				unsigned feedback = bits;
-				bits >>= 1;
-				feedback = 1 & (feedback ^ bits);
-				time += period;
-				bits = (feedback << tap) | (bits & mask);
-				// feedback just happens to be true only when the level needs to change
-				// (the previous and current bits are different)
-				if ( feedback ) {
+				const int count = steps < tap ? int (steps) : tap;
+				steps -= count;
+				unsigned changes = gb_noise_steps( bits, tap, count );
+				while ( changes ) {
+					const blip_resampled_time_t t =
+							resampled_time + gb_lowest_bit( changes ) * resampled_period;
+					changes &= changes - 1;
 					amp = -amp;
-					synth->offset_resampled( resampled_time, amp, output );
+					synth.offset_resampled( t, amp, output );
 				}
-				resampled_time += resampled_period;
+				resampled_time += count * resampled_period;
 			}
-			while ( time < end_time );
+			while ( steps );
 			
 			this->bits = bits;
 			last_amp = amp >> 1;
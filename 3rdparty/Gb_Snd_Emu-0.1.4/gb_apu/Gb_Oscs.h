@@ -10,6 +10,14 @@
 
 enum { gb_apu_max_vol = 7 };
 
+// Synthesis quality tiers (see Gb_Apu::quality())
+const int gb_draft_quality  = 0;
+const int gb_normal_quality = 1;
+const int gb_high_quality   = 2;
+const int gb_ultra_quality  = 3;
+
+template<int normal_quality> struct Gb_Synths;
+
 struct Gb_Osc {
     
 	Blip_Buffer* outputs [4]; // NULL, right, left, center
@@ -27,15 +35,34 @@ struct Gb_Osc {
 	bool enabled;
 	bool length_enabled;
 	
+	// If true, a square or wave whose waveform repeats above the output's Nyquist
+	// frequency adds its average level instead of its transitions, and counts
+	// the transitions it skipped in 'skipped'.
+	bool skip_ultrasonic;
+	long skipped;
+	
+	// Synthesis quality tier the oscillator adds transitions with
+	int quality;
+	
 	Gb_Osc();
     virtual ~Gb_Osc() {}
 	
 	void clock_length();
+	bool length_counting() const { return length_enabled && length; }
 	void reset();
 	virtual void run( gb_time_t begin, gb_time_t end ) = 0;
 	virtual void write_register( int reg, int value );
+	bool ultrasonic( int cycle ) const;
 };
 
+// True if skipping ultrasonic output and a waveform 'cycle' clocks long
+// repeats more than once every two output samples
+inline bool Gb_Osc::ultrasonic( int cycle ) const
+{
+	return skip_ultrasonic && output->resampled_duration( cycle ) <
+			(blip_resampled_time_t (2) << BLIP_BUFFER_ACCURACY);
+}
+
 struct Gb_Env : Gb_Osc {
 	int env_period;
 	int env_dir;
@@ -46,6 +73,12 @@ struct Gb_Env : Gb_Osc {
 	void reset();
 	void clock_envelope();
 	void write_register( int, int );
+	
+	// True if clock_envelope() can still change volume
+	bool envelope_changing() const { return env_delay && (env_dir ? volume < 15 : volume > 0); }
+	
+	// Same as calling clock_envelope() count times while it can't change volume
+	void skip_envelope( int count );
 };
 
 struct Gb_Square : Gb_Env {
@@ -59,14 +92,18 @@ struct Gb_Square : Gb_Env {
 	int sweep_freq;
 	bool has_sweep;
 	
-	typedef Blip_Synth<blip_good_quality,15 * gb_apu_max_vol * 2> Synth;
-	const Synth* synth;
+	typedef Blip_Synth<blip_good_quality,15 * gb_apu_max_vol * 2> Synth; // normal quality
+	typedef Gb_Synths<blip_good_quality> Synths;
+	const Synths* synths;
 	
 	Gb_Square();
 	void reset();
 	void run( gb_time_t, gb_time_t );
+	template<class Tier>
+	void run_tier( gb_time_t, gb_time_t, const Tier& );
 	void write_register( int, int );
 	void clock_sweep();
+	bool sweep_active() const { return sweep_period && sweep_delay; }
 };
 
 struct Gb_Wave : Gb_Osc {
@@ -76,12 +113,15 @@ struct Gb_Wave : Gb_Osc {
 	bool new_enabled;
 	BOOST::uint8_t wave [wave_size];
 	
-	typedef Blip_Synth<blip_med_quality,15 * gb_apu_max_vol * 2> Synth;
-	const Synth* synth;
+	typedef Blip_Synth<blip_med_quality,15 * gb_apu_max_vol * 2> Synth; // normal quality
+	typedef Gb_Synths<blip_med_quality> Synths;
+	const Synths* synths;
 	
 	Gb_Wave();
 	void reset();
 	void run( gb_time_t, gb_time_t );
+	template<class Tier>
+	void run_tier( gb_time_t, gb_time_t, const Tier& );
 	void write_register( int, int );
 };
 
@@ -89,14 +129,99 @@ struct Gb_Noise : Gb_Env {
 	unsigned bits;
 	int tap;
 	
-	typedef Blip_Synth<blip_med_quality,15 * gb_apu_max_vol * 2> Synth;
-	const Synth* synth;
+	typedef Blip_Synth<blip_med_quality,15 * gb_apu_max_vol * 2> Synth; // normal quality
+	typedef Gb_Synths<blip_med_quality> Synths;
+	const Synths* synths;
 	
 	Gb_Noise();
 	void reset();
 	void run( gb_time_t, gb_time_t );
+	template<class Tier>
+	void run_tier( gb_time_t, gb_time_t, const Tier& );
 	void write_register( int, int );
 };
 
+// Step the noise LFSR count times at once, where count must not exceed tap, and
+// return a mask with bit n set if step n + 1 changes the output bit. The steps
+// only shift and feed back bits at or below tap, so they are done in parallel.
+inline unsigned gb_noise_steps( unsigned& bits, int tap, int count )
+{
+	const unsigned low_mask = (2u << tap) - 1;
+	const unsigned low = bits & low_mask;
+	const unsigned changes = (low ^ (low >> 1)) & ((1u << count) - 1);
+	bits = ((bits >> count) & ~low_mask) | (low >> count) | (changes << (tap + 1 - count));
+	return changes;
+}
+
+// Index of the lowest set bit of n, which must not be zero
+inline int gb_lowest_bit( unsigned n )
+{
+#if defined (__GNUC__)
+	return __builtin_ctz( n );
+#else
+	int i = 0;
+	while ( !(n & 1) ) {
+		n >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+// An oscillator type's synths at every quality tier. Draft has the narrowest
+// impulse, normal is the one Gb_Snd_Emu always used, ultra is the widest
+// Blip_Buffer supports. All are kept set up so tiers can be switched at any time.
+template<int normal_quality>
+struct Gb_Synths {
+	enum { range = 15 * gb_apu_max_vol * 2 };
+	Blip_Synth<blip_low_quality,range>  draft;
+	Blip_Synth<normal_quality,range>    normal;
+	Blip_Synth<blip_high_quality,range> high;
+	Blip_Synth<5,range>                 ultra;
+	
+	void volume( double v )
+	{
+		draft.volume( v );
+		normal.volume( v );
+		high.volume( v );
+		ultra.volume( v );
+	}
+	
+	void treble_eq( const blip_eq_t& eq )
+	{
+		draft.treble_eq( eq );
+		normal.treble_eq( eq );
+		high.treble_eq( eq );
+		ultra.treble_eq( eq );
+	}
+	
+	void prepare_treble_eq( const blip_eq_t& eq )
+	{
+		draft.prepare_treble_eq( eq );
+		normal.prepare_treble_eq( eq );
+		high.prepare_treble_eq( eq );
+		ultra.prepare_treble_eq( eq );
+	}
+	
+	void take_prepared_eq()
+	{
+		draft.take_prepared_eq();
+		normal.take_prepared_eq();
+		high.take_prepared_eq();
+		ultra.take_prepared_eq();
+	}
+	
+	void offset( int quality, blip_time_t time, int delta, Blip_Buffer* buf ) const
+	{
+		switch ( quality )
+		{
+			case gb_draft_quality: draft.offset( time, delta, buf ); break;
+			case gb_high_quality:  high.offset( time, delta, buf ); break;
+			case gb_ultra_quality: ultra.offset( time, delta, buf ); break;
+			default:               normal.offset( time, delta, buf ); break;
+		}
+	}
+};
+
 #endif
 
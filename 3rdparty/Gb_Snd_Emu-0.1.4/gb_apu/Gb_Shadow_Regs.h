@@ -0,0 +1,99 @@
+
+// Shadow copy of the Gb_Apu registers which drops redundant writes
+
+// Added for PAPU. GNU LGPL license, same as the rest of Gb_Snd_Emu.
+
+#ifndef GB_SHADOW_REGS_H
+#define GB_SHADOW_REGS_H
+
+#include "Gb_Apu.h"
+
+class Gb_Shadow_Regs {
+public:
+	Gb_Shadow_Regs();
+
+	// Forget all shadowed values, so the next write to each register goes through
+	void reset();
+
+	// Queue write of 'data' to address if it differs from the last value written
+	// there, or if 'force' is true
+	void write( gb_addr_t, int data, bool force = false );
+
+	// True if any writes are waiting to be flushed
+	bool pending() const;
+
+	// Last value written to address, or -1 if none has been
+	int read( gb_addr_t ) const;
+
+	// Apply queued writes to apu in address order, the first at 'time' + 'step'
+	// and each following one 'step' clocks later. Return time of last write.
+	// Once all of wave RAM has been written, changes to it are applied with a
+	// single write_wave_ram().
+	gb_time_t flush( Gb_Apu&, gb_time_t time, int step );
+
+private:
+	typedef BOOST::uint64_t mask_t;
+	enum { wave_ram_reg = Gb_Apu::wave_ram_addr - Gb_Apu::start_addr };
+	static const mask_t wave_ram_mask = ((mask_t (1) << Gb_Apu::wave_ram_size) - 1) << wave_ram_reg;
+	BOOST::uint8_t regs [Gb_Apu::register_count];
+	mask_t valid;
+	mask_t dirty;
+
+	BOOST_STATIC_ASSERT( Gb_Apu::register_count <= 64 );
+};
+
+inline Gb_Shadow_Regs::Gb_Shadow_Regs() { reset(); }
+
+inline void Gb_Shadow_Regs::reset()
+{
+	valid = 0;
+	dirty = 0;
+}
+
+inline bool Gb_Shadow_Regs::pending() const { return dirty != 0; }
+
+inline void Gb_Shadow_Regs::write( gb_addr_t addr, int data, bool force )
+{
+	unsigned reg = addr - Gb_Apu::start_addr;
+	assert( reg < Gb_Apu::register_count );
+
+	mask_t const bit = mask_t (1) << reg;
+	if ( force || !(valid & bit) || regs [reg] != data )
+	{
+		regs [reg] = BOOST::uint8_t (data);
+		valid |= bit;
+		dirty |= bit;
+	}
+}
+
+inline int Gb_Shadow_Regs::read( gb_addr_t addr ) const
+{
+	unsigned reg = addr - Gb_Apu::start_addr;
+	assert( reg < Gb_Apu::register_count );
+	return (valid >> reg & 1) ? regs [reg] : -1;
+}
+
+inline gb_time_t Gb_Shadow_Regs::flush( Gb_Apu& apu, gb_time_t time, int step )
+{
+	mask_t bits = dirty;
+	dirty = 0;
+	
+	// wave RAM comes last in address order
+	bool wave_ram = (bits & wave_ram_mask) && (valid & wave_ram_mask) == wave_ram_mask;
+	if ( wave_ram )
+		bits &= ~wave_ram_mask;
+	
+	for ( unsigned reg = 0; bits; reg++, bits >>= 1 )
+	{
+		if ( bits & 1 )
+			apu.write_register( time += step, Gb_Apu::start_addr + reg, regs [reg] );
+	}
+	
+	if ( wave_ram )
+		apu.write_wave_ram( time += step, regs + wave_ram_reg );
+	
+	return time;
+}
+
+#endif
+
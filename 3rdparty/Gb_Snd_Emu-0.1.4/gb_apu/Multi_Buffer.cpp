@@ -99,12 +99,31 @@ void Stereo_Buffer::bass_freq( int bass )
 		bufs [i].bass_freq( bass );
 }
 
+void Stereo_Buffer::bass_freq( int bass, int shift )
+{
+	for ( unsigned i = 0; i < buf_count; i++ )
+		bufs [i].bass_freq( bass, shift );
+}
+
 void Stereo_Buffer::clear()
+{
+	clear( true );
+}
+
+void Stereo_Buffer::clear( bool entire_buffer )
 {
 	stereo_added = false;
 	was_stereo = false;
 	for ( int i = 0; i < buf_count; i++ )
-		bufs [i].clear();
+		bufs [i].clear( entire_buffer );
+}
+
+bool Stereo_Buffer::settled( int threshold ) const
+{
+	for ( int i = 0; i < buf_count; i++ )
+		if ( !bufs [i].settled( threshold ) )
+			return false;
+	return true;
 }
 
 void Stereo_Buffer::end_frame( blip_time_t clock_count, bool stereo )
@@ -124,34 +143,58 @@ long Stereo_Buffer::read_samples( blip_sample_t* out, long count )
 		count = avail;
 	if ( count )
 	{
-		if ( stereo_added || was_stereo )
-		{
+		bool stereo = stereo_added || was_stereo;
+		if ( stereo )
 			mix_stereo( out, count );
-			
-			bufs [0].remove_samples( count );
-			bufs [1].remove_samples( count );
-			bufs [2].remove_samples( count );
-		}
 		else
-		{
 			mix_mono( out, count );
-			
-			bufs [0].remove_samples( count );
-			
-			bufs [1].remove_silence( count );
-			bufs [2].remove_silence( count );
-		}
 		
-		// to do: this might miss opportunities for optimization
-		if ( !bufs [0].samples_avail() ) {
-			was_stereo = stereo_added;
-			stereo_added = false;
-		}
+		remove_mixed( count, stereo );
 	}
 	
 	return count;
 }
 
+long Stereo_Buffer::add_samples( float* left, float* right, long count )
+{
+	long avail = bufs [0].samples_avail();
+	if ( count > avail )
+		count = avail;
+	if ( count )
+	{
+		bool stereo = stereo_added || was_stereo;
+		if ( stereo )
+			mix_stereo( left, right, count );
+		else
+			mix_mono( left, right, count );
+		
+		remove_mixed( count, stereo );
+	}
+	
+	return count;
+}
+
+void Stereo_Buffer::remove_mixed( long count, bool stereo )
+{
+	bufs [0].remove_samples( count );
+	if ( stereo )
+	{
+		bufs [1].remove_samples( count );
+		bufs [2].remove_samples( count );
+	}
+	else
+	{
+		bufs [1].remove_silence( count );
+		bufs [2].remove_silence( count );
+	}
+	
+	// to do: this might miss opportunities for optimization
+	if ( !bufs [0].samples_avail() ) {
+		was_stereo = stereo_added;
+		stereo_added = false;
+	}
+}
+
 #include BLARGG_ENABLE_OPTIMIZER
 
 void Stereo_Buffer::mix_stereo( blip_sample_t* out, long count )
@@ -166,22 +209,20 @@ void Stereo_Buffer::mix_stereo( blip_sample_t* out, long count )
 	
 	while ( count-- )
 	{
-		int c = center.read();
-		long l = c + left.read();
-		long r = c + right.read();
+		blip_long_t c = center.read();
+		blip_long_t l = c + left.read();
+		blip_long_t r = c + right.read();
 		center.next( bass );
 		out [0] = blip_sample_t (l);
 		out [1] = blip_sample_t (r);
 		out += 2;
 		
-		if ( (BOOST::int16_t) l != l )
-			out [-2] = 0x7FFF - (l >> 24);
+		BLIP_CLAMP( l, out [-2] );
 		
 		left.next( bass );
 		right.next( bass );
 		
-		if ( (BOOST::int16_t) r != r )
-			out [-1] = 0x7FFF - (r >> 24);
+		BLIP_CLAMP( r, out [-1] );
 	}
 	
 	center.end( bufs [0] );
@@ -196,17 +237,76 @@ void Stereo_Buffer::mix_mono( blip_sample_t* out, long count )
 	
 	while ( count-- )
 	{
-		long s = in.read();
+		blip_long_t s = in.read();
 		in.next( bass );
-		out [0] = s;
-		out [1] = s;
+		BLIP_CLAMP( s, s );
+		out [0] = blip_sample_t (s);
+		out [1] = blip_sample_t (s);
 		out += 2;
+	}
+	
+	in.end( bufs [0] );
+}
+
+// The float versions keep each channel's integrator in its own register and
+// write planar output directly. The integrator is a recurrence, so there is
+// nothing to gain from vectorizing across time. With BLIP_BUFFER_WIDE the
+// output isn't clamped, so levels past 16 bits reach the caller intact.
+
+void Stereo_Buffer::mix_stereo( float* out_l, float* out_r, long count )
+{
+	float const scale = 1.0f / 32768;
+	
+	Blip_Reader left; 
+	Blip_Reader right; 
+	Blip_Reader center;
+	
+	left.begin( bufs [1] );
+	right.begin( bufs [2] );
+	int bass = center.begin( bufs [0] );
+	
+	for ( long n = 0; n < count; n++ )
+	{
+		blip_long_t c = center.read();
+		blip_long_t l = c + left.read();
+		blip_long_t r = c + right.read();
+		center.next( bass );
+		left.next( bass );
+		right.next( bass );
+		
+	#if !BLIP_BUFFER_WIDE
+		BLIP_CLAMP( l, l );
+		BLIP_CLAMP( r, r );
+	#endif
+		
+		out_l [n] += l * scale;
+		out_r [n] += r * scale;
+	}
+	
+	center.end( bufs [0] );
+	right.end( bufs [2] );
+	left.end( bufs [1] );
+}
+
+void Stereo_Buffer::mix_mono( float* out_l, float* out_r, long count )
+{
+	float const scale = 1.0f / 32768;
+	
+	Blip_Reader in;
+	int bass = in.begin( bufs [0] );
+	
+	for ( long n = 0; n < count; n++ )
+	{
+		blip_long_t s = in.read();
+		in.next( bass );
+		
+	#if !BLIP_BUFFER_WIDE
+		BLIP_CLAMP( s, s );
+	#endif
 		
-		if ( (BOOST::int16_t) s != s ) {
-			s = 0x7FFF - (s >> 24);
-			out [-2] = s;
-			out [-1] = s;
-		}
+		float f = s * scale;
+		out_l [n] += f;
+		out_r [n] += f;
 	}
 	
 	in.end( bufs [0] );
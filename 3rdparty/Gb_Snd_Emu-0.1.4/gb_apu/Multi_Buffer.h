@@ -105,8 +105,20 @@ public:
 	channel_t channel( int index );
 	void end_frame( blip_time_t, bool added_stereo = true );
 	
+	// See Blip_Buffer.h
+	void bass_freq( int, int shift );
+	void clear( bool entire_buffer );
+	bool settled( int threshold = 1 ) const;
+	
 	long samples_avail() const;
 	long read_samples( blip_sample_t*, long );
+	blip_time_t count_clocks( long count ) const;
+	
+	// Add at most 'count' samples to separate left and right float buffers,
+	// scaled so that 16-bit full scale is 1.0, and remove them from the buffer.
+	// Samples are clamped exactly as read_samples() does. Returns number of
+	// samples actually added.
+	long add_samples( float* left, float* right, long count );
 	
 private:
 	enum { buf_count = 3 };
@@ -117,6 +129,9 @@ private:
 	
 	void mix_stereo( blip_sample_t*, long );
 	void mix_mono( blip_sample_t*, long );
+	void mix_stereo( float*, float*, long );
+	void mix_mono( float*, float*, long );
+	void remove_mixed( long count, bool stereo );
 };
 
 // Silent_Buffer generates no samples, useful where no sound is wanted
@@ -154,6 +169,8 @@ inline int Multi_Buffer::samples_per_frame() const { return samples_per_frame_;
 
 inline long Stereo_Buffer::samples_avail() const { return bufs [0].samples_avail(); }
 
+inline blip_time_t Stereo_Buffer::count_clocks( long count ) const { return bufs [0].count_clocks( count ); }
+
 inline Stereo_Buffer::channel_t Stereo_Buffer::channel( int index ) { (void)index; return chan; }
 
 inline long Multi_Buffer::sample_rate() const { return sample_rate_; }
@@ -0,0 +1,842 @@
+// Added for PAPU. GNU LGPL license, same as the rest of Gb_Snd_Emu.
+
+#include "Gb_Apu_Bank.h"
+
+#include <string.h>
+
+#if defined (__AVX2__)
+	#include <immintrin.h>
+	#define GB_BANK_AVX2 1
+#elif defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define GB_BANK_SSE2 1
+#endif
+
+#include BLARGG_SOURCE_BEGIN
+
+const int trigger = 0x80;
+
+// Eight 32-bit lanes, held in one AVX2 register, two SSE2 registers or, on
+// other targets, an array the compiler is left to vectorize. Masks are -1
+// where true and 0 where false.
+
+BOOST_STATIC_ASSERT( Gb_Apu_Bank::lane_count == 8 );
+
+struct bank_lanes {
+#if GB_BANK_AVX2
+	__m256i v;
+#elif GB_BANK_SSE2
+	__m128i lo, hi;
+#else
+	int v [8];
+#endif
+};
+
+#if GB_BANK_AVX2
+
+	#define BANK_LANES_OP( name, avx, sse, expr ) \
+		static inline bank_lanes name( bank_lanes a, bank_lanes b ) \
+			{ bank_lanes r; r.v = avx( a.v, b.v ); return r; }
+
+	static inline bank_lanes lanes_load( const int* p )
+		{ bank_lanes r; r.v = _mm256_loadu_si256( (const __m256i*) p ); return r; }
+	static inline void lanes_store( int* p, bank_lanes a )
+		{ _mm256_storeu_si256( (__m256i*) p, a.v ); }
+	static inline bank_lanes lanes_set( int n )
+		{ bank_lanes r; r.v = _mm256_set1_epi32( n ); return r; }
+	static inline bank_lanes lanes_srlv( bank_lanes a, bank_lanes count )
+		{ bank_lanes r; r.v = _mm256_srlv_epi32( a.v, count.v ); return r; }
+	static inline bool lanes_any( bank_lanes mask )
+		{ return _mm256_movemask_epi8( mask.v ) != 0; }
+
+#elif GB_BANK_SSE2
+
+	#define BANK_LANES_OP( name, avx, sse, expr ) \
+		static inline bank_lanes name( bank_lanes a, bank_lanes b ) \
+			{ bank_lanes r; r.lo = sse( a.lo, b.lo ); r.hi = sse( a.hi, b.hi ); return r; }
+
+	static inline bank_lanes lanes_load( const int* p )
+	{
+		bank_lanes r;
+		r.lo = _mm_loadu_si128( (const __m128i*) p );
+		r.hi = _mm_loadu_si128( (const __m128i*) (p + 4) );
+		return r;
+	}
+	static inline void lanes_store( int* p, bank_lanes a )
+	{
+		_mm_storeu_si128( (__m128i*) p, a.lo );
+		_mm_storeu_si128( (__m128i*) (p + 4), a.hi );
+	}
+	static inline bank_lanes lanes_set( int n )
+		{ bank_lanes r; r.lo = r.hi = _mm_set1_epi32( n ); return r; }
+	static inline bank_lanes lanes_srlv( bank_lanes a, bank_lanes count )
+	{
+		// SSE2 has no per-lane shift
+		int x [8], n [8];
+		lanes_store( x, a );
+		lanes_store( n, count );
+		for ( int i = 0; i < 8; i++ )
+			x [i] = int (unsigned (x [i]) >> n [i]);
+		return lanes_load( x );
+	}
+	static inline bool lanes_any( bank_lanes mask )
+		{ return _mm_movemask_epi8( _mm_or_si128( mask.lo, mask.hi ) ) != 0; }
+
+#else
+
+	#define BANK_LANES_OP( name, avx, sse, expr ) \
+		static inline bank_lanes name( bank_lanes a, bank_lanes b ) { \
+			bank_lanes r; \
+			for ( int i = 0; i < 8; i++ ) { int x = a.v [i], y = b.v [i]; r.v [i] = (expr); } \
+			return r; \
+		}
+
+	static inline bank_lanes lanes_load( const int* p )
+		{ bank_lanes r; memcpy( r.v, p, sizeof r.v ); return r; }
+	static inline void lanes_store( int* p, bank_lanes a )
+		{ memcpy( p, a.v, sizeof a.v ); }
+	static inline bank_lanes lanes_set( int n )
+		{ bank_lanes r; for ( int i = 0; i < 8; i++ ) r.v [i] = n; return r; }
+	static inline bank_lanes lanes_srlv( bank_lanes a, bank_lanes count )
+		{ for ( int i = 0; i < 8; i++ ) a.v [i] = int (unsigned (a.v [i]) >> count.v [i]); return a; }
+	static inline bool lanes_any( bank_lanes mask )
+		{ int any = 0; for ( int i = 0; i < 8; i++ ) any |= mask.v [i]; return any != 0; }
+
+#endif
+
+BANK_LANES_OP( lanes_add,    _mm256_add_epi32,    _mm_add_epi32,    x + y )
+BANK_LANES_OP( lanes_sub,    _mm256_sub_epi32,    _mm_sub_epi32,    x - y )
+BANK_LANES_OP( lanes_and,    _mm256_and_si256,    _mm_and_si128,    x & y )
+BANK_LANES_OP( lanes_or,     _mm256_or_si256,     _mm_or_si128,     x | y )
+BANK_LANES_OP( lanes_andnot, _mm256_andnot_si256, _mm_andnot_si128, ~x & y ) // ~a & b
+BANK_LANES_OP( lanes_eq,     _mm256_cmpeq_epi32,  _mm_cmpeq_epi32,  -(x == y) )
+BANK_LANES_OP( lanes_gt,     _mm256_cmpgt_epi32,  _mm_cmpgt_epi32,  -(x > y) )
+
+static inline bank_lanes lanes_nonzero( bank_lanes a )
+{
+	return lanes_andnot( lanes_eq( a, lanes_set( 0 ) ), lanes_set( -1 ) );
+}
+
+static inline bank_lanes lanes_select( bank_lanes mask, bank_lanes a, bank_lanes b )
+{
+	return lanes_or( lanes_and( mask, a ), lanes_andnot( mask, b ) );
+}
+
+// Gb_Apu_Bank
+
+Gb_Apu_Bank::Gb_Apu_Bank()
+{
+	// state which Gb_Apu leaves to its first use starts out cleared here
+	memset( &square1, 0, sizeof square1 );
+	memset( &square2, 0, sizeof square2 );
+	memset( &wave, 0, sizeof wave );
+	memset( &noise, 0, sizeof noise );
+
+	square1.has_sweep = true;
+	square2.has_sweep = false;
+
+	oscs [0] = &square1;
+	oscs [1] = &square2;
+	oscs [2] = &wave;
+	oscs [3] = &noise;
+
+	volume( 1.0 );
+	reset();
+}
+
+void Gb_Apu_Bank::treble_eq( const blip_eq_t& eq )
+{
+	square_synth.treble_eq( eq );
+	other_synth.treble_eq( eq );
+}
+
+void Gb_Apu_Bank::volume( double vol )
+{
+	vol *= 0.60 / osc_count;
+	square_synth.volume( vol );
+	other_synth.volume( vol );
+}
+
+void Gb_Apu_Bank::output( int lane, Blip_Buffer* center, Blip_Buffer* left, Blip_Buffer* right )
+{
+	require( (unsigned) lane < lane_count );
+
+	if ( center && !left && !right )
+	{
+		// mono
+		left = center;
+		right = center;
+	}
+	else
+	{
+		// must be silenced or stereo
+		require( (!left && !right) || (left && right) );
+	}
+
+	for ( int i = 0; i < osc_count; i++ )
+	{
+		Osc& osc = *oscs [i];
+		osc.outputs [lane] [1] = right;
+		osc.outputs [lane] [2] = left;
+		osc.outputs [lane] [3] = center;
+		osc.output [lane] = osc.outputs [lane] [osc.output_select [lane]];
+	}
+}
+
+void Gb_Apu_Bank::reset()
+{
+	next_frame_time = 0;
+	last_time = 0;
+	frame_count = 0;
+	stereo_found = 0;
+
+	for ( int lane = 0; lane < lane_count; lane++ )
+	{
+		reset_square( square1, lane );
+		reset_square( square2, lane );
+
+		wave.volume_shift [lane] = 0;
+		wave.wave_pos [lane] = 0;
+		wave.new_length [lane] = 0;
+		memset( wave.wave [lane], 0, sizeof wave.wave [lane] );
+		reset_osc( wave, lane );
+
+		noise.bits [lane] = 1;
+		noise.tap [lane] = 14;
+		reset_env( noise, lane );
+	}
+
+	memset( regs, 0, sizeof regs );
+}
+
+void Gb_Apu_Bank::reset_osc( Osc& o, int i )
+{
+	o.delay [i] = 0;
+	o.last_amp [i] = 0;
+	o.period [i] = 2048;
+	o.volume [i] = 0;
+	o.global_volume [i] = 7;
+	o.frequency [i] = 0;
+	o.length [i] = 0;
+	o.enabled [i] = false;
+	o.length_enabled [i] = false;
+	o.output_select [i] = 3;
+	o.output [i] = o.outputs [i] [3];
+}
+
+void Gb_Apu_Bank::reset_env( Env& o, int i )
+{
+	o.env_period [i] = 0;
+	o.env_dir [i] = 0;
+	o.env_delay [i] = 0;
+	o.new_volume [i] = 0;
+	reset_osc( o, i );
+}
+
+void Gb_Apu_Bank::reset_square( Square& o, int i )
+{
+	o.phase [i] = 1;
+	o.duty [i] = 1;
+
+	o.sweep_period [i] = 0;
+	o.sweep_delay [i] = 0;
+	o.sweep_shift [i] = 0;
+	o.sweep_dir [i] = 0;
+	o.sweep_freq [i] = 0;
+
+	o.new_length [i] = 0;
+
+	reset_env( o, i );
+}
+
+// Register writes, one lane at a time. These follow Gb_Osc and its
+// subclasses exactly.
+
+void Gb_Apu_Bank::write_osc( Osc& o, int i, int reg, int value )
+{
+	if ( reg == 4 )
+		o.length_enabled [i] = (value & 0x40) != 0;
+}
+
+void Gb_Apu_Bank::write_env( Env& o, int i, int reg, int value )
+{
+	if ( reg == 2 ) {
+		o.env_period [i] = value & 7;
+		o.env_dir [i] = value & 8;
+		o.volume [i] = o.new_volume [i] = value >> 4;
+	}
+	else if ( reg == 4 && (value & trigger) ) {
+		o.env_delay [i] = o.env_period [i];
+		o.volume [i] = o.new_volume [i];
+		o.enabled [i] = true;
+	}
+	write_osc( o, i, reg, value );
+}
+
+void Gb_Apu_Bank::clock_sweep( Square& o, int i )
+{
+	if ( o.sweep_period [i] && o.sweep_delay [i] && !--o.sweep_delay [i] )
+	{
+		o.sweep_delay [i] = o.sweep_period [i];
+		o.frequency [i] = o.sweep_freq [i];
+
+		o.period [i] = (2048 - o.frequency [i]) * 4;
+
+		int offset = o.sweep_freq [i] >> o.sweep_shift [i];
+		if ( o.sweep_dir [i] )
+			offset = -offset;
+		o.sweep_freq [i] += offset;
+
+		if ( o.sweep_freq [i] < 0 )
+		{
+			o.sweep_freq [i] = 0;
+		}
+		else if ( o.sweep_freq [i] >= 2048 )
+		{
+			o.sweep_delay [i] = 0;
+			o.sweep_freq [i] = 2048; // stop sound output
+		}
+	}
+}
+
+void Gb_Apu_Bank::write_square( Square& o, int i, int reg, int value )
+{
+	static unsigned char const duty_table [4] = { 1, 2, 4, 6 };
+
+	switch ( reg )
+	{
+	case 0:
+		o.sweep_period [i] = (value >> 4) & 7;
+		o.sweep_shift [i] = value & 7;
+		o.sweep_dir [i] = value & 0x08;
+		break;
+
+	case 1:
+		o.new_length [i] = o.length [i] = 64 - (value & 0x3f);
+		o.duty [i] = duty_table [value >> 6];
+		break;
+
+	case 3:
+		o.frequency [i] = (o.frequency [i] & ~0xFF) + value;
+		o.length [i] = o.new_length [i];
+		break;
+
+	case 4:
+		o.frequency [i] = (value & 7) * 0x100 + (o.frequency [i] & 0xFF);
+		o.length [i] = o.new_length [i];
+		if ( value & trigger )
+		{
+			o.sweep_freq [i] = o.frequency [i];
+			if ( o.has_sweep && o.sweep_period [i] && o.sweep_shift [i] )
+			{
+				o.sweep_delay [i] = 1;
+				clock_sweep( o, i );
+			}
+		}
+		break;
+	}
+
+	o.period [i] = (2048 - o.frequency [i]) * 4;
+
+	write_env( o, i, reg, value );
+}
+
+void Gb_Apu_Bank::write_wave( Wave& o, int i, int reg, int value )
+{
+	switch ( reg )
+	{
+	case 0:
+		o.new_enabled [i] = (value & 0x80) != 0;
+		o.enabled [i] &= o.new_enabled [i];
+		break;
+
+	case 1:
+		o.new_length [i] = o.length [i] = 256 - value;
+		break;
+
+	case 2:
+		o.volume [i] = ((value >> 5) & 3);
+		o.volume_shift [i] = (o.volume [i] - 1) & 7; // silence = 7
+		break;
+
+	case 3:
+		o.frequency [i] = (o.frequency [i] & ~0xFF) + value;
+		break;
+
+	case 4:
+		o.frequency [i] = (value & 7) * 0x100 + (o.frequency [i] & 0xFF);
+		if ( o.new_enabled [i] && (value & trigger) )
+		{
+			o.wave_pos [i] = 0;
+			o.length [i] = o.new_length [i];
+			o.enabled [i] = true;
+		}
+		break;
+	}
+
+	o.period [i] = (2048 - o.frequency [i]) * 2;
+
+	write_osc( o, i, reg, value );
+}
+
+void Gb_Apu_Bank::write_noise( Noise& o, int i, int reg, int value )
+{
+	if ( reg == 1 ) {
+		o.new_length [i] = o.length [i] = 64 - (value & 0x3f);
+	}
+	else if ( reg == 2 ) {
+		// see Gb_Noise::write_register()
+		int temp = o.volume [i];
+		write_env( o, i, reg, value );
+		if ( ( value & 0xF8 ) != 0 ) o.volume [i] = temp;
+		return;
+	}
+	else if ( reg == 3 ) {
+		o.tap [i] = 14 - (value & 8);
+		int divisor = (value & 7) * 16;
+		if ( !divisor )
+			divisor = 8;
+		o.period [i] = divisor << (value >> 4);
+	}
+	else if ( reg == 4 && value & trigger ) {
+		o.bits [i] = ~0u;
+		o.length [i] = o.new_length [i];
+	}
+
+	write_env( o, i, reg, value );
+}
+
+void Gb_Apu_Bank::write_register( int lane, gb_time_t time, gb_addr_t addr, int data )
+{
+	require( (unsigned) lane < lane_count );
+	require( (unsigned) data < 0x100 );
+
+	int reg = addr - Gb_Apu::start_addr;
+	if ( (unsigned) reg >= Gb_Apu::register_count )
+		return;
+
+	run_until( time );
+
+	regs [lane] [reg] = data;
+
+	if ( addr < 0xff24 )
+	{
+		// oscillator
+		int index = reg / 5;
+		reg -= index * 5;
+		switch ( index )
+		{
+			case 0: write_square( square1, lane, reg, data ); break;
+			case 1: write_square( square2, lane, reg, data ); break;
+			case 2: write_wave( wave, lane, reg, data ); break;
+			case 3: write_noise( noise, lane, reg, data ); break;
+		}
+	}
+	else if ( addr == 0xff24 )
+	{
+		int global_volume = data & 7;
+		int old_volume = square1.global_volume [lane];
+		if ( old_volume != global_volume )
+		{
+			int any_enabled = false;
+			for ( int i = 0; i < osc_count; i++ )
+			{
+				Osc& osc = *oscs [i];
+				if ( osc.enabled [lane] )
+				{
+					if ( osc.last_amp [lane] )
+					{
+						int new_amp = osc.last_amp [lane] * global_volume / osc.global_volume [lane];
+						if ( osc.output [lane] )
+							square_synth.offset( time, new_amp - osc.last_amp [lane], osc.output [lane] );
+						osc.last_amp [lane] = new_amp;
+					}
+					any_enabled |= osc.volume [lane];
+				}
+				osc.global_volume [lane] = global_volume;
+			}
+
+			if ( !any_enabled && square1.outputs [lane] [3] )
+				square_synth.offset( time, (global_volume - old_volume) * 15 * 2, square1.outputs [lane] [3] );
+		}
+	}
+	else if ( addr == 0xff25 || addr == 0xff26 )
+	{
+		int mask = (regs [lane] [0xff26 - Gb_Apu::start_addr] & 0x80) ? ~0 : 0;
+		int flags = regs [lane] [0xff25 - Gb_Apu::start_addr] & mask;
+
+		// left/right assignments
+		for ( int i = 0; i < osc_count; i++ )
+		{
+			Osc& osc = *oscs [i];
+			osc.enabled [lane] &= mask;
+			int bits = flags >> i;
+			Blip_Buffer* old_output = osc.output [lane];
+			osc.output_select [lane] = (bits >> 3 & 2) | (bits & 1);
+			osc.output [lane] = osc.outputs [lane] [osc.output_select [lane]];
+			if ( osc.output [lane] != old_output && osc.last_amp [lane] )
+			{
+				if ( old_output )
+					square_synth.offset( time, -osc.last_amp [lane], old_output );
+				osc.last_amp [lane] = 0;
+			}
+		}
+	}
+	else if ( addr >= 0xff30 )
+	{
+		int index = (addr & 0x0f) * 2;
+		wave.wave [lane] [index] = data >> 4;
+		wave.wave [lane] [index + 1] = data & 0x0f;
+	}
+}
+
+int Gb_Apu_Bank::read_register( int lane, gb_time_t time, gb_addr_t addr )
+{
+	require( (unsigned) lane < lane_count );
+	require( Gb_Apu::start_addr <= addr && addr <= Gb_Apu::end_addr );
+
+	run_until( time );
+
+	int data = regs [lane] [addr - Gb_Apu::start_addr];
+
+	if ( addr == 0xff26 )
+	{
+		data &= 0xf0;
+		for ( int i = 0; i < osc_count; i++ )
+		{
+			const Osc& osc = *oscs [i];
+			if ( osc.enabled [lane] && (osc.length [lane] || !osc.length_enabled [lane]) )
+				data |= 1 << i;
+		}
+	}
+
+	return data;
+}
+
+// Frame sequencer, every lane at once
+
+void Gb_Apu_Bank::clock_length( Osc& o )
+{
+	bank_lanes length = lanes_load( o.length );
+
+	// where length_enabled && length, --length
+	bank_lanes dec = lanes_and( lanes_nonzero( lanes_load( o.length_enabled ) ), lanes_nonzero( length ) );
+	lanes_store( o.length, lanes_add( length, dec ) );
+}
+
+void Gb_Apu_Bank::clock_envelope( Env& o )
+{
+	bank_lanes const zero = lanes_set( 0 );
+	bank_lanes delay = lanes_load( o.env_delay );
+
+	// where env_delay && !--env_delay
+	bank_lanes counting = lanes_nonzero( delay );
+	delay = lanes_add( delay, counting );
+	bank_lanes fire = lanes_and( counting, lanes_eq( delay, zero ) );
+	if ( !lanes_any( fire ) )
+	{
+		lanes_store( o.env_delay, delay );
+		return;
+	}
+
+	lanes_store( o.env_delay, lanes_select( fire, lanes_load( o.env_period ), delay ) );
+
+	bank_lanes volume = lanes_load( o.volume );
+	bank_lanes up = lanes_nonzero( lanes_load( o.env_dir ) );
+	bank_lanes inc = lanes_and( lanes_and( fire, up ), lanes_gt( lanes_set( 15 ), volume ) );
+	bank_lanes dec = lanes_and( lanes_andnot( up, fire ), lanes_gt( volume, zero ) );
+	lanes_store( o.volume, lanes_add( lanes_sub( volume, inc ), dec ) );
+}
+
+void Gb_Apu_Bank::clock_sweep( Square& o )
+{
+	bank_lanes const zero = lanes_set( 0 );
+	bank_lanes sweep_period = lanes_load( o.sweep_period );
+	bank_lanes sweep_delay = lanes_load( o.sweep_delay );
+
+	// where sweep_period && sweep_delay && !--sweep_delay
+	bank_lanes counting = lanes_and( lanes_nonzero( sweep_period ), lanes_nonzero( sweep_delay ) );
+	sweep_delay = lanes_add( sweep_delay, counting );
+	bank_lanes fire = lanes_and( counting, lanes_eq( sweep_delay, zero ) );
+	if ( !lanes_any( fire ) )
+	{
+		lanes_store( o.sweep_delay, sweep_delay );
+		return;
+	}
+
+	sweep_delay = lanes_select( fire, sweep_period, sweep_delay );
+
+	bank_lanes sweep_freq = lanes_load( o.sweep_freq );
+	bank_lanes frequency = lanes_select( fire, sweep_freq, lanes_load( o.frequency ) );
+	lanes_store( o.frequency, frequency );
+
+	bank_lanes period = lanes_sub( lanes_set( 2048 ), frequency );
+	period = lanes_add( period, period );
+	period = lanes_add( period, period );
+	lanes_store( o.period, lanes_select( fire, period, lanes_load( o.period ) ) );
+
+	// sweep_freq is never negative, so a logical shift matches the original
+	bank_lanes offset = lanes_srlv( sweep_freq, lanes_load( o.sweep_shift ) );
+	bank_lanes negate = lanes_nonzero( lanes_load( o.sweep_dir ) );
+	offset = lanes_select( negate, lanes_sub( zero, offset ), offset );
+	bank_lanes freq = lanes_add( sweep_freq, offset );
+
+	freq = lanes_andnot( lanes_gt( zero, freq ), freq ); // below 0 clamps to 0
+	bank_lanes stop = lanes_gt( freq, lanes_set( 2047 ) );
+	freq = lanes_select( stop, lanes_set( 2048 ), freq ); // stop sound output
+	sweep_delay = lanes_andnot( lanes_and( fire, stop ), sweep_delay );
+
+	lanes_store( o.sweep_freq, lanes_select( fire, freq, sweep_freq ) );
+	lanes_store( o.sweep_delay, sweep_delay );
+}
+
+#include BLARGG_ENABLE_OPTIMIZER
+
+// Oscillators, one lane at a time. These follow Gb_Square::run(),
+// Gb_Wave::run() and Gb_Noise::run() exactly.
+
+void Gb_Apu_Bank::run_square( Square& o, int i, gb_time_t time, gb_time_t end_time )
+{
+	Blip_Buffer* const output = o.output [i];
+	int const volume = o.volume [i];
+	int const period = o.period [i];
+
+	if ( !o.enabled [i] || (!o.length [i] && o.length_enabled [i]) || !volume ||
+			o.sweep_freq [i] == 2048 || !o.frequency [i] || period < 27 )
+	{
+		if ( o.last_amp [i] )
+		{
+			square_synth.offset( time, -o.last_amp [i], output );
+			o.last_amp [i] = 0;
+		}
+		o.delay [i] = 0;
+	}
+	else
+	{
+		int amp = (o.phase [i] < o.duty [i]) ? volume : -volume;
+		amp *= o.global_volume [i];
+		if ( amp != o.last_amp [i] )
+		{
+			square_synth.offset( time, amp - o.last_amp [i], output );
+			o.last_amp [i] = amp;
+		}
+
+		time += o.delay [i];
+		if ( time < end_time )
+		{
+			int const duty = o.duty [i];
+			int phase = o.phase [i];
+			// keep parallel resampled time to eliminate multiplication in the loop
+			const blip_resampled_time_t resampled_period =
+					output->resampled_duration( period );
+			blip_resampled_time_t resampled_time = output->resampled_time( time );
+			amp *= 2;
+			do
+			{
+				phase = (phase + 1) & 7;
+				if ( phase == 0 || phase == duty )
+				{
+					amp = -amp;
+					square_synth.offset_resampled( resampled_time, amp, output );
+				}
+				time += period;
+				resampled_time += resampled_period;
+			}
+			while ( time < end_time );
+
+			o.phase [i] = phase;
+			o.last_amp [i] = amp >> 1;
+		}
+		o.delay [i] = int (time - end_time);
+	}
+}
+
+void Gb_Apu_Bank::run_wave( int i, gb_time_t time, gb_time_t end_time )
+{
+	Wave& o = wave;
+	Blip_Buffer* const output = o.output [i];
+	int const period = o.period [i];
+
+	if ( !o.enabled [i] || (!o.length [i] && o.length_enabled [i]) || !o.volume [i] ||
+			!o.frequency [i] || period < 7 )
+	{
+		if ( o.last_amp [i] ) {
+			other_synth.offset( time, -o.last_amp [i], output );
+			o.last_amp [i] = 0;
+		}
+		o.delay [i] = 0;
+	}
+	else
+	{
+		BOOST::uint8_t const* const wave = o.wave [i];
+		int const vol_factor = o.global_volume [i] * 2;
+		int const volume_shift = o.volume_shift [i];
+		int last_amp = o.last_amp [i];
+
+		// wave data or shift may have changed
+		int diff = (wave [o.wave_pos [i]] >> volume_shift) * vol_factor - last_amp;
+		if ( diff )
+		{
+			last_amp += diff;
+			other_synth.offset( time, diff, output );
+		}
+
+		time += o.delay [i];
+		if ( time < end_time )
+		{
+			int wave_pos = o.wave_pos [i];
+			// keep parallel resampled time to eliminate multiplication in the loop
+			const blip_resampled_time_t resampled_period =
+					output->resampled_duration( period );
+			blip_resampled_time_t resampled_time = output->resampled_time( time );
+
+			do
+			{
+				wave_pos = unsigned (wave_pos + 1) % Wave::wave_size;
+				int amp = (wave [wave_pos] >> volume_shift) * vol_factor;
+				int delta = amp - last_amp;
+				if ( delta )
+				{
+					last_amp = amp;
+					other_synth.offset_resampled( resampled_time, delta, output );
+				}
+				time += period;
+				resampled_time += resampled_period;
+			}
+			while ( time < end_time );
+
+			o.wave_pos [i] = wave_pos;
+		}
+		o.last_amp [i] = last_amp;
+		o.delay [i] = int (time - end_time);
+	}
+}
+
+void Gb_Apu_Bank::run_noise( int i, gb_time_t time, gb_time_t end_time )
+{
+	Noise& o = noise;
+	Blip_Buffer* const output = o.output [i];
+
+	if ( !o.enabled [i] || (!o.length [i] && o.length_enabled [i]) || !o.volume [i] ) {
+		if ( o.last_amp [i] ) {
+			other_synth.offset( time, -o.last_amp [i], output );
+			o.last_amp [i] = 0;
+		}
+		o.delay [i] = 0;
+	}
+	else
+	{
+		int amp = o.bits [i] & 1 ? -o.volume [i] : o.volume [i];
+		amp *= o.global_volume [i];
+		if ( amp != o.last_amp [i] ) {
+			other_synth.offset( time, amp - o.last_amp [i], output );
+			o.last_amp [i] = amp;
+		}
+
+		time += o.delay [i];
+		if ( time < end_time )
+		{
+			int const period = o.period [i];
+			// keep parallel resampled time to eliminate multiplication in the loop
+			const blip_resampled_time_t resampled_period =
+					output->resampled_duration( period );
+			blip_resampled_time_t resampled_time = output->resampled_time( time );
+			const int tap = o.tap [i];
+			unsigned bits = o.bits [i];
+			amp *= 2;
+
+			// step the LFSR up to tap times at once and only visit the steps
+			// where the level changes
+			long steps = (end_time - time + period - 1) / period;
+			time += steps * period;
+			do {
+				const int count = steps < tap ? int (steps) : tap;
+				steps -= count;
+				unsigned changes = gb_noise_steps( bits, tap, count );
+				while ( changes ) {
+					const blip_resampled_time_t t =
+							resampled_time + gb_lowest_bit( changes ) * resampled_period;
+					changes &= changes - 1;
+					amp = -amp;
+					other_synth.offset_resampled( t, amp, output );
+				}
+				resampled_time += count * resampled_period;
+			}
+			while ( steps );
+
+			o.bits [i] = bits;
+			o.last_amp [i] = amp >> 1;
+		}
+		o.delay [i] = int (time - end_time);
+	}
+}
+
+void Gb_Apu_Bank::run_until( gb_time_t end_time )
+{
+	require( end_time >= last_time ); // end_time must not be before previous time
+	if ( end_time == last_time )
+		return;
+
+	while ( true )
+	{
+		gb_time_t time = next_frame_time;
+		if ( time > end_time )
+			time = end_time;
+
+		// run oscillators
+		for ( int lane = 0; lane < lane_count; lane++ )
+		{
+			for ( int i = 0; i < osc_count; ++i )
+			{
+				Osc const& osc = *oscs [i];
+				if ( osc.output [lane] && osc.output [lane] != osc.outputs [lane] [3] )
+					stereo_found |= 1u << lane;
+			}
+
+			if ( square1.output [lane] ) run_square( square1, lane, last_time, time );
+			if ( square2.output [lane] ) run_square( square2, lane, last_time, time );
+			if ( wave.output [lane] )    run_wave( lane, last_time, time );
+			if ( noise.output [lane] )   run_noise( lane, last_time, time );
+		}
+		last_time = time;
+
+		if ( time == end_time )
+			break;
+
+		next_frame_time += 4194304 / 256; // 256 Hz
+
+		// 256 Hz actions
+		clock_length( square1 );
+		clock_length( square2 );
+		clock_length( wave );
+		clock_length( noise );
+
+		frame_count = (frame_count + 1) & 3;
+		if ( frame_count == 0 ) {
+			// 64 Hz actions
+			clock_envelope( square1 );
+			clock_envelope( square2 );
+			clock_envelope( noise );
+		}
+
+		if ( frame_count & 1 )
+			clock_sweep( square1 ); // 128 Hz action
+	}
+}
+
+unsigned Gb_Apu_Bank::end_frame( gb_time_t end_time )
+{
+	if ( end_time > last_time )
+		run_until( end_time );
+
+	assert( next_frame_time >= end_time );
+	next_frame_time -= end_time;
+
+	assert( last_time >= end_time );
+	last_time -= end_time;
+
+	unsigned result = stereo_found;
+	stereo_found = 0;
+	return result;
+}
+
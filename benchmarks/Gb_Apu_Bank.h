@@ -0,0 +1,158 @@
+// Bank of Game Boy PAPU sound chips emulated side by side
+
+// Added for PAPU. GNU LGPL license, same as the rest of Gb_Snd_Emu.
+
+#ifndef GB_APU_BANK_H
+#define GB_APU_BANK_H
+
+#include "Gb_Apu.h"
+
+// Emulates lane_count chips in lock step, each one equivalent to a Gb_Apu.
+// Every field of the oscillator state is kept as an array across lanes, so
+// the frame sequencer (length, envelope and sweep clocks) updates all lanes
+// with a few SIMD integer ops. Oscillators still run lane by lane, since each
+// makes its own transitions, but without virtual calls or pointer chasing.
+// Output is bit-identical to lane_count separate Gb_Apu which get the same
+// writes and have their frames ended at the same times.
+//
+// An experiment kept with its benchmark. bench_bank times it within about 10%
+// of separate Gb_Apu: the oscillator runs dominate, and the frame sequencer
+// the lanes share is a small part of the work. PAPU doesn't use it.
+class Gb_Apu_Bank {
+public:
+	Gb_Apu_Bank();
+
+	enum { lane_count = 8 };
+	enum { osc_count = Gb_Apu::osc_count };
+
+	// Set overall volume of all oscillators in all lanes, where 1.0 is full volume
+	void volume( double );
+
+	// Set treble equalization of all lanes
+	void treble_eq( const blip_eq_t& );
+
+	// Reset oscillators and internal state of all lanes
+	void reset();
+
+	// Assign all oscillator outputs of a lane to specified buffer(s). See Gb_Apu.h.
+	void output( int lane, Blip_Buffer* mono );
+	void output( int lane, Blip_Buffer* center, Blip_Buffer* left, Blip_Buffer* right );
+
+	// Write 'data' to address of a lane at specified time. All lanes are run up to
+	// 'time' first, so times must not go backwards from one lane to another.
+	void write_register( int lane, gb_time_t, gb_addr_t, int data );
+
+	// Read from address of a lane at specified time
+	int read_register( int lane, gb_time_t, gb_addr_t );
+
+	// Run all lanes up to specified time, end current time frame, then start a
+	// new frame at time 0. Return a mask with bit n set if lane n added sound to
+	// one of its left/right buffers.
+	unsigned end_frame( gb_time_t );
+
+	// True if no oscillator of a lane is currently adding anything to its output
+	bool silent( int lane ) const;
+
+private:
+	// noncopyable
+	Gb_Apu_Bank( const Gb_Apu_Bank& );
+	Gb_Apu_Bank& operator = ( const Gb_Apu_Bank& );
+
+	typedef int lanes_t [lane_count];
+
+	// Gb_Osc and its subclasses, with one array element per lane
+	struct Osc {
+		Blip_Buffer* outputs [lane_count] [4]; // NULL, right, left, center
+		Blip_Buffer* output [lane_count];
+		lanes_t output_select;
+		lanes_t delay;
+		lanes_t last_amp;
+		lanes_t period;
+		lanes_t volume;
+		lanes_t global_volume;
+		lanes_t frequency;
+		lanes_t length;
+		lanes_t new_length;
+		lanes_t enabled;
+		lanes_t length_enabled;
+	};
+
+	struct Env : Osc {
+		lanes_t env_period;
+		lanes_t env_dir;
+		lanes_t env_delay;
+		lanes_t new_volume;
+	};
+
+	struct Square : Env {
+		lanes_t phase;
+		lanes_t duty;
+		lanes_t sweep_period;
+		lanes_t sweep_delay;
+		lanes_t sweep_shift;
+		lanes_t sweep_dir;
+		lanes_t sweep_freq;
+		bool has_sweep;
+	};
+
+	struct Wave : Osc {
+		enum { wave_size = Gb_Wave::wave_size };
+		lanes_t volume_shift;
+		lanes_t wave_pos;
+		lanes_t new_enabled;
+		BOOST::uint8_t wave [lane_count] [wave_size];
+	};
+
+	struct Noise : Env {
+		unsigned bits [lane_count];
+		lanes_t tap;
+	};
+
+	Square      square1;
+	Square      square2;
+	Wave        wave;
+	Noise       noise;
+	Osc*        oscs [osc_count];
+	gb_time_t   next_frame_time;
+	gb_time_t   last_time;
+	int         frame_count;
+	unsigned    stereo_found;
+	BOOST::uint8_t regs [lane_count] [Gb_Apu::register_count];
+	Gb_Square::Synth square_synth; // shared between squares of all lanes
+	Gb_Wave::Synth   other_synth;  // shared between wave and noise of all lanes
+
+	void run_until( gb_time_t );
+
+	static void reset_osc( Osc&, int lane );
+	static void reset_env( Env&, int lane );
+	static void reset_square( Square&, int lane );
+
+	static void write_osc( Osc&, int lane, int reg, int value );
+	static void write_env( Env&, int lane, int reg, int value );
+	static void write_square( Square&, int lane, int reg, int value );
+	static void write_wave( Wave&, int lane, int reg, int value );
+	static void write_noise( Noise&, int lane, int reg, int value );
+	static void clock_sweep( Square&, int lane );
+
+	// frame sequencer, all lanes at once
+	static void clock_length( Osc& );
+	static void clock_envelope( Env& );
+	static void clock_sweep( Square& );
+
+	void run_square( Square&, int lane, gb_time_t, gb_time_t );
+	void run_wave( int lane, gb_time_t, gb_time_t );
+	void run_noise( int lane, gb_time_t, gb_time_t );
+};
+
+inline void Gb_Apu_Bank::output( int lane, Blip_Buffer* b ) { output( lane, b, nullptr, nullptr ); }
+
+inline bool Gb_Apu_Bank::silent( int lane ) const
+{
+	for ( int i = 0; i < osc_count; i++ )
+		if ( oscs [i]->last_amp [lane] )
+			return false;
+	return true;
+}
+
+#endif
+
@@ -0,0 +1,49 @@
+/*
+  ==============================================================================
+
+    Small helpers shared by the benchmarks. Each benchmark is a standalone
+    program; pass a number on the command line to scale its workload.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    inline Clock::time_point now()
+    {
+        return Clock::now();
+    }
+
+    inline double secondsSince (Clock::time_point start)
+    {
+        return std::chrono::duration<double> (Clock::now() - start).count();
+    }
+
+    // Workload size, multiplied by the optional first command line argument
+    inline int scaled (int argc, char** argv, int base)
+    {
+        const double scale = argc > 1 ? std::atof (argv[1]) : 1.0;
+        return std::max (1, int (base * scale));
+    }
+
+    // Written by consume(). Being volatile and visible outside this file, the
+    // stores can't be dropped, and no warning says the value is never read.
+    template <typename T>
+    inline volatile T sink {};
+
+    // Keeps the optimiser from discarding results
+    template <typename T>
+    inline void consume (const T& value)
+    {
+        sink<T> = value;
+    }
+}
@@ -0,0 +1,332 @@
+/*
+  ==============================================================================
+
+    Checks Gb_Apu_Bank against eight separate Gb_Apu, then times the two.
+
+    Both get the same random register traffic, including triggers, sweeps,
+    envelopes, length counters, panning, master volume, power toggles and
+    wave RAM writes, and every lane's output must match its Gb_Apu sample
+    for sample. A mismatch fails the run, so `make run` stops there.
+
+  ==============================================================================
+*/
+
+#include "gb_apu/Gb_Apu.h"
+#include "gb_apu/Multi_Buffer.h"
+
+#include "bench.h"
+#include "Gb_Apu_Bank.h"
+
+#include <vector>
+
+static const long clockRate = 4194304;
+static const int blockSize = 512;
+static const int lanes = Gb_Apu_Bank::lane_count;
+static const int repeats = 5;
+
+//==============================================================================
+struct Rng
+{
+    unsigned state;
+
+    explicit Rng (unsigned seed) : state (seed * 2654435761u + 1) {}
+
+    unsigned next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    int below (int n) { return int (next() % unsigned (n)); }
+};
+
+struct Write
+{
+    blip_time_t time;
+    int lane, addr, data;
+};
+
+// Register writes for one frame, in time order across all lanes
+static void makeFrame (Rng& rng, blip_time_t frame, int maxWrites, std::vector<Write>& writes)
+{
+    writes.clear();
+
+    const int count = rng.below (maxWrites + 1);
+    for (int i = 0; i < count; i++)
+    {
+        Write w;
+        w.time = rng.below (int (frame));
+        w.lane = rng.below (lanes);
+
+        const int kind = rng.below (16);
+        if (kind < 6)
+        {
+            // retrigger or retune one of the oscillators
+            static const int bases[] = { 0xff10, 0xff15, 0xff1a, 0xff1f };
+            w.addr = bases[rng.below (4)] + 1 + rng.below (4);
+            w.data = rng.below (256);
+        }
+        else if (kind < 9)
+        {
+            // envelope with a short period, so it steps within a few frames
+            static const int envs[] = { 0xff12, 0xff17, 0xff21 };
+            w.addr = envs[rng.below (3)];
+            w.data = rng.below (256) & 0xfb;
+        }
+        else if (kind < 10)
+        {
+            w.addr = 0xff10; // sweep
+            w.data = rng.below (128);
+        }
+        else if (kind < 11)
+        {
+            w.addr = 0xff1a + rng.below (2) * 2; // wave enable, volume
+            w.data = rng.below (256);
+        }
+        else if (kind < 12)
+        {
+            w.addr = 0xff30 + rng.below (16);
+            w.data = rng.below (256);
+        }
+        else if (kind < 14)
+        {
+            w.addr = 0xff24 + rng.below (2);
+            w.data = rng.below (256);
+        }
+        else if (kind < 15)
+        {
+            w.addr = 0xff26;
+            w.data = rng.below (8) ? 0x80 : 0x00;
+        }
+        else
+        {
+            w.addr = 0xff10 + rng.below (0x30);
+            w.data = rng.below (256);
+        }
+
+        writes.push_back (w);
+    }
+
+    std::sort (writes.begin(), writes.end(), [] (const Write& a, const Write& b) { return a.time < b.time; });
+}
+
+//==============================================================================
+// Eight chips with a Stereo_Buffer per lane, either separate or banked
+struct Separate
+{
+    Gb_Apu apus[lanes];
+
+    void output (int lane, Stereo_Buffer& b) { apus[lane].output (b.center(), b.left(), b.right()); }
+    void treble (double t)                   { for (auto& a : apus) a.treble_eq (t); }
+    void write (const Write& w)              { apus[w.lane].write_register (w.time, gb_addr_t (w.addr), w.data); }
+
+    unsigned endFrame (blip_time_t t)
+    {
+        unsigned stereo = 0;
+        for (int i = 0; i < lanes; i++)
+            stereo |= unsigned (apus[i].end_frame (t)) << i;
+        return stereo;
+    }
+};
+
+struct Banked
+{
+    Gb_Apu_Bank bank;
+
+    void output (int lane, Stereo_Buffer& b) { bank.output (lane, b.center(), b.left(), b.right()); }
+    void treble (double t)                   { bank.treble_eq (t); }
+    void write (const Write& w)              { bank.write_register (w.lane, w.time, gb_addr_t (w.addr), w.data); }
+    unsigned endFrame (blip_time_t t)        { return bank.end_frame (t); }
+};
+
+template <class Chips>
+struct Rig
+{
+    Chips chips;
+    Stereo_Buffer bufs[lanes];
+
+    explicit Rig (long sampleRate)
+    {
+        chips.treble (-20.0);
+
+        for (int i = 0; i < lanes; i++)
+        {
+            bufs[i].bass_freq (461);
+            bufs[i].clock_rate (clockRate);
+            bufs[i].set_sample_rate (sampleRate);
+            bufs[i].clear();
+            chips.output (i, bufs[i]);
+
+            // power on, and write every register once so no state is left
+            // to a constructor
+            chips.write ({ 0, i, 0xff26, 0x80 });
+            for (int addr = 0xff10; addr <= 0xff25; addr++)
+                chips.write ({ 0, i, addr, 0 });
+        }
+    }
+
+    blip_time_t frameLength() const
+    {
+        return bufs[0].count_clocks (blockSize - bufs[0].samples_avail());
+    }
+
+    unsigned emulate (const std::vector<Write>& writes, blip_time_t frame)
+    {
+        for (auto& w : writes)
+            chips.write (w);
+
+        return chips.endFrame (frame);
+    }
+
+    void read (unsigned stereo, blip_time_t frame, blip_sample_t* out)
+    {
+        for (int i = 0; i < lanes; i++)
+        {
+            bufs[i].end_frame (frame, (stereo >> i) & 1);
+            bufs[i].read_samples (out + i * blockSize * 2, blockSize);
+        }
+    }
+};
+
+//==============================================================================
+static bool checkExact (unsigned seed, long sampleRate, int frames)
+{
+    Rng rng (seed);
+    Rig<Separate> separate (sampleRate);
+    Rig<Banked> banked (sampleRate);
+
+    std::vector<Write> writes;
+    std::vector<blip_sample_t> a (lanes * blockSize * 2), b (lanes * blockSize * 2);
+
+    for (int f = 0; f < frames; f++)
+    {
+        const blip_time_t frame = separate.frameLength();
+        makeFrame (rng, frame, 40, writes);
+
+        const unsigned stereoA = separate.emulate (writes, frame);
+        const unsigned stereoB = banked.emulate (writes, frame);
+        separate.read (stereoA, frame, a.data());
+        banked.read (stereoB, frame, b.data());
+
+        if (stereoA != stereoB || a != b)
+        {
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                if (a[i] != b[i])
+                {
+                    printf ("MISMATCH seed %u, %ld Hz, frame %d, lane %d, sample %d: %d != %d\n",
+                            seed, sampleRate, f, int (i / (blockSize * 2)), int (i % (blockSize * 2)), a[i], b[i]);
+                    return false;
+                }
+            }
+
+            printf ("MISMATCH seed %u, %ld Hz, frame %d: stereo lanes %02x != %02x\n", seed, sampleRate, f, stereoA, stereoB);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+// Every lane plays both squares, wave and noise, retriggering a note every
+// few frames with the patch runOscs() writes
+template <class Chips>
+static double runWorkload (long sampleRate, long samples)
+{
+    Rig<Chips> rig (sampleRate);
+
+    std::vector<Write> writes;
+    std::vector<blip_sample_t> out (lanes * blockSize * 2);
+
+    for (int i = 0; i < lanes; i++)
+    {
+        rig.chips.write ({ 0, i, 0xff24, 0x77 });
+        rig.chips.write ({ 0, i, 0xff25, 0xf5 });
+        rig.chips.write ({ 0, i, 0xff1a, 0x80 });
+        rig.chips.write ({ 0, i, 0xff1c, 0x20 });
+        for (int j = 0; j < 16; j++)
+            rig.chips.write ({ 0, i, 0xff30 + j, j * 0x11 });
+    }
+
+    double seconds = 0;
+    int block = 0;
+
+    for (long done = 0; done < samples; done += blockSize, block++)
+    {
+        const blip_time_t frame = rig.frameLength();
+
+        writes.clear();
+        if (block % 8 == 0)
+        {
+            for (int i = 0; i < lanes; i++)
+            {
+                const int period = 1600 + ((block / 8 + i * 5) % 24) * 12;
+                const blip_time_t t = frame * i / lanes;
+
+                const Write note[] =
+                {
+                    { t, i, 0xff10, 0x23 }, { t, i, 0xff11, 0x80 }, { t, i, 0xff12, 0xf3 },
+                    { t, i, 0xff13, period & 0xff }, { t, i, 0xff14, 0x80 | (period >> 8) },
+                    { t, i, 0xff16, 0x40 }, { t, i, 0xff17, 0xa2 },
+                    { t, i, 0xff18, (period + 7) & 0xff }, { t, i, 0xff19, 0x80 | ((period + 7) >> 8) },
+                    { t, i, 0xff1d, period & 0xff }, { t, i, 0xff1e, 0x80 | (period >> 8) },
+                    { t, i, 0xff21, 0xf2 }, { t, i, 0xff22, 0x51 }, { t, i, 0xff23, 0x80 },
+                };
+
+                writes.insert (writes.end(), std::begin (note), std::end (note));
+            }
+        }
+
+        // only the emulation is timed, the output stage is the same for both
+        const auto start = bench::now();
+        const unsigned stereo = rig.emulate (writes, frame);
+        seconds += bench::secondsSince (start);
+
+        rig.read (stereo, frame, out.data());
+    }
+
+    bench::consume (out[0]);
+    return seconds;
+}
+
+template <class Fn>
+static double best (Fn fn)
+{
+    double t = 1e9;
+    for (int r = 0; r < repeats; r++)
+        t = std::min (t, fn());
+    return t;
+}
+
+int main (int argc, char** argv)
+{
+    const int frames = bench::scaled (argc, argv, 2000);
+    const long rates[] = { 44100, 48000, 96000 };
+
+    for (unsigned seed = 1; seed <= 8; seed++)
+        for (long rate : rates)
+            if (! checkExact (seed, rate, frames))
+                return 1;
+
+    printf ("Gb_Apu_Bank matches %d separate Gb_Apu over %d random frames x 24 runs\n\n", lanes, frames);
+
+    const double audioSeconds = bench::scaled (argc, argv, 1000) / 1000.0;
+
+    printf ("%d chips playing, %.2f s of audio per run\n", lanes, audioSeconds);
+    printf ("%-14s %7s %10s %12s\n", "chips", "rate", "ns/sample", "ns/chip");
+
+    for (long rate : rates)
+    {
+        const long samples = long (audioSeconds * rate);
+        const double a = best ([&] { return runWorkload<Separate> (rate, samples); });
+        const double b = best ([&] { return runWorkload<Banked> (rate, samples); });
+
+        printf ("%-14s %7ld %10.2f %12.2f\n", "separate", rate, a * 1e9 / samples, a * 1e9 / samples / lanes);
+        printf ("%-14s %7ld %10.2f %12.2f\n", "bank", rate, b * 1e9 / samples, b * 1e9 / samples / lanes);
+    }
+
+    return 0;
+}
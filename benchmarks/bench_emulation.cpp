@@ -0,0 +1,1160 @@
+/*
+  ==============================================================================
+
+    Times the hot loops of the Game Boy sound emulation: the square, wave
+    and noise oscillator runs, Blip_Synth::offset_resampled and the output
+    stage (Blip_Buffer::read_samples and Stereo_Buffer's mixers), at the
+    sample rates PAPU is commonly run at, and with ultrasonic squares and
+    wave synthesised or skipped at lower rates. Each quality tier's synths
+    are timed as well. Several chips are also mixed
+    through a buffer each and through one shared Gb_Apu_Bus, and the cost
+    of creating chips is measured.
+
+    Every workload is deterministic, so results from two builds can be
+    compared directly. Each figure is the best of several runs. Before
+    timing anything, the Blip_Synth impulse loop is checked against a
+    scalar reference, the noise LFSR's multi-step update against single
+    steps, planar float output from Stereo_Buffer::add_samples() against
+    read_samples(), and equalization prepared for the next frame against
+    treble_eq(), also while another thread keeps preparing it. Wide builds
+    also check that a 16-voice chord on the shared bus equals the sum of
+    its voices. A mismatch fails the run.
+
+  ==============================================================================
+*/
+
+#include "gb_apu/Gb_Apu.h"
+#include "gb_apu/Gb_Apu_Bus.h"
+#include "gb_apu/Multi_Buffer.h"
+
+#include "bench.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static const long clockRate = 4194304;
+static const long sampleRates[] = { 44100, 48000, 96000, 192000 };
+static const int blockSize = 512;
+static const int repeats = 5;
+
+//==============================================================================
+// Steps the noise LFSR once, the way the hardware does, and returns true if
+// the output bit changed
+static bool noiseStep (unsigned& bits, int tap)
+{
+    unsigned feedback = bits;
+    bits >>= 1;
+    feedback = 1 & (feedback ^ bits);
+    bits = (feedback << tap) | (bits & ~(1u << tap));
+    return feedback != 0;
+}
+
+// Number of times the noise output bit changes in the given number of LFSR
+// steps after a trigger
+static long noiseToggles (int tap, long steps)
+{
+    unsigned bits = ~0u;
+    long toggles = 0;
+
+    for (long i = 0; i < steps; i++)
+        toggles += noiseStep (bits, tap);
+
+    return toggles;
+}
+
+// Checks gb_noise_steps() against single steps for every count, from every
+// state of the taps' low bits and a few of the bits above them
+static bool checkNoiseSteps()
+{
+    for (int tap : { 6, 14 })
+    {
+        for (unsigned high : { 0u, 0x5a5a5a5au, ~0u })
+        {
+            for (unsigned low = 0; low < (2u << tap); low++)
+            {
+                const unsigned start = (high & ~((2u << tap) - 1)) | low;
+
+                for (int count = 0; count <= tap; count++)
+                {
+                    unsigned expected = start, changes = 0;
+                    for (int i = 0; i < count; i++)
+                        changes |= unsigned (noiseStep (expected, tap)) << i;
+
+                    unsigned bits = start;
+                    if (gb_noise_steps (bits, tap, count) != changes || bits != expected)
+                    {
+                        printf ("MISMATCH noise tap %d, state %08x, %d steps: %08x != %08x\n",
+                                tap, start, count, bits, expected);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+struct Workload
+{
+    const char* name;
+    void (*setup) (Gb_Apu&);
+    long (*transitions) (long clocks); // transitions the oscillators make in 'clocks', 0 if not known
+    void (*block) (Gb_Apu&, int block) = nullptr; // register writes at the start of each block
+};
+
+static void powerOn (Gb_Apu& apu, bool stereo, int channels)
+{
+    apu.write_register (0, 0xff26, 0x80);
+    apu.write_register (0, 0xff24, 0x07);
+
+    // both sides of a channel select the center buffer, one side selects left
+    int pan = 0;
+    for (int i = 0; i < 4; i++)
+        if (channels & (1 << i))
+            pan |= stereo ? (0x10 << i) : (0x11 << i);
+
+    apu.write_register (0, 0xff25, pan);
+}
+
+static void square (Gb_Apu& apu, int frequency)
+{
+    apu.write_register (0, 0xff11, 0x80); // 50% duty
+    apu.write_register (0, 0xff12, 0xf0); // full volume, no envelope
+    apu.write_register (0, 0xff13, frequency & 0xff);
+    apu.write_register (0, 0xff14, 0x80 | (frequency >> 8));
+}
+
+static void noise (Gb_Apu& apu, int nr43)
+{
+    apu.write_register (0, 0xff21, 0xf0);
+    apu.write_register (0, 0xff22, nr43);
+    apu.write_register (0, 0xff23, 0x80);
+}
+
+// square period is (2048 - frequency) * 4 clocks, with two transitions per cycle of 8 periods
+static const int highSquare = 2040;  // 16384 Hz, just above the period < 27 mute
+static const int lowSquare  = 1798;  // about 524 Hz
+
+// noise period is divisor << shift, divisor 8 for ratio 0
+static const int fastNoise = 0x00;   // 8 clocks per step
+static const int slowNoise = 0x52;   // 1024 clocks per step
+
+// A drum pattern on the noise channel, retriggering every 4 blocks with a
+// decaying envelope: closed hats at the fastest rate, with a snare and a
+// kick on the beats
+static void drums (Gb_Apu& apu, int block)
+{
+    if (block % 4 != 0)
+        return;
+
+    static const struct { int envelope, nr43; } hits[] =
+    {
+        { 0xf1, 0x00 }, { 0xa1, 0x08 }, { 0xf2, 0x11 }, { 0xa1, 0x08 },
+        { 0xf1, 0x00 }, { 0xa1, 0x08 }, { 0xf3, 0x45 }, { 0xa1, 0x01 },
+    };
+
+    auto& hit = hits[(block / 4) % 8];
+    apu.write_register (0, 0xff21, hit.envelope);
+    apu.write_register (0, 0xff22, hit.nr43);
+    apu.write_register (0, 0xff23, 0x80);
+}
+
+// wave period is (2048 - frequency) * 2 clocks per wave RAM step
+static const int waveFrequency = 1920;
+static const int highWave = 2044;    // 16384 Hz, just above the period < 7 mute
+
+static void wave (Gb_Apu& apu, int frequency)
+{
+    // a ramp, so every step of the wave is a transition
+    for (int i = 0; i < 16; i++)
+        apu.write_register (0, gb_addr_t (0xff30 + i), ((i * 2) << 4) | (i * 2 + 1));
+
+    apu.write_register (0, 0xff1a, 0x80); // enable
+    apu.write_register (0, 0xff1c, 0x20); // full volume
+    apu.write_register (0, 0xff1d, frequency & 0xff);
+    apu.write_register (0, 0xff1e, 0x80 | (frequency >> 8));
+}
+
+static const Workload workloads[] =
+{
+    {
+        "silence",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 0); },
+        [] (long) { return 0L; }
+    },
+    {
+        "square low",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 1); square (apu, lowSquare); },
+        [] (long clocks) { return clocks / ((2048 - lowSquare) * 4 * 4); }
+    },
+    {
+        "square high",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 1); square (apu, highSquare); },
+        [] (long clocks) { return clocks / ((2048 - highSquare) * 4 * 4); }
+    },
+    {
+        "wave",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 4); wave (apu, waveFrequency); },
+        [] (long clocks) { return clocks / ((2048 - waveFrequency) * 2); }
+    },
+    {
+        "noise 15-step",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 8); noise (apu, fastNoise); },
+        [] (long clocks) { return noiseToggles (14, clocks / 8); }
+    },
+    {
+        "noise 7-step",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 8); noise (apu, fastNoise | 0x08); },
+        [] (long clocks) { return noiseToggles (6, clocks / 8); }
+    },
+    {
+        "noise slow",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 8); noise (apu, slowNoise); },
+        [] (long clocks) { return noiseToggles (14, clocks / 1024); }
+    },
+    {
+        "noise drums",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 8); },
+        [] (long) { return 0L; },
+        drums
+    },
+    {
+        "all mono",
+        [] (Gb_Apu& apu)
+        {
+            powerOn (apu, false, 1 | 2 | 8);
+            square (apu, lowSquare);
+            apu.write_register (0, 0xff16, 0x40);
+            apu.write_register (0, 0xff17, 0xf0);
+            apu.write_register (0, 0xff18, (lowSquare + 7) & 0xff);
+            apu.write_register (0, 0xff19, 0x80 | ((lowSquare + 7) >> 8));
+            noise (apu, slowNoise);
+        },
+        [] (long clocks)
+        {
+            return clocks / ((2048 - lowSquare) * 4 * 4) + clocks / ((2048 - lowSquare - 7) * 4 * 4)
+                 + noiseToggles (14, clocks / 1024);
+        }
+    },
+    {
+        "all stereo",
+        [] (Gb_Apu& apu)
+        {
+            powerOn (apu, true, 1 | 2 | 8);
+            square (apu, lowSquare);
+            apu.write_register (0, 0xff16, 0x40);
+            apu.write_register (0, 0xff17, 0xf0);
+            apu.write_register (0, 0xff18, (lowSquare + 7) & 0xff);
+            apu.write_register (0, 0xff19, 0x80 | ((lowSquare + 7) >> 8));
+            noise (apu, slowNoise);
+        },
+        [] (long clocks)
+        {
+            return clocks / ((2048 - lowSquare) * 4 * 4) + clocks / ((2048 - lowSquare - 7) * 4 * 4)
+                 + noiseToggles (14, clocks / 1024);
+        }
+    },
+};
+
+// Oscillators above the Nyquist frequency of the lower sample rates
+static const long ultrasonicRates[] = { 22050, 32000, 44100 };
+
+static const Workload ultrasonicWorkloads[] =
+{
+    {
+        "square high",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 1); square (apu, highSquare); },
+        [] (long clocks) { return clocks / ((2048 - highSquare) * 4 * 4); }
+    },
+    {
+        "wave high",
+        [] (Gb_Apu& apu) { powerOn (apu, false, 4); wave (apu, highWave); },
+        [] (long clocks) { return clocks / ((2048 - highWave) * 2); }
+    },
+};
+
+// Renders 'samples' samples of a workload in host sized blocks, the way
+// PAPUEngine::render() does, and returns the time taken
+static double runApu (const Workload& w, long sampleRate, long samples, long& clocks,
+                      long* skipped = nullptr, int quality = gb_normal_quality)
+{
+    Gb_Apu apu;
+    Stereo_Buffer buf;
+    apu.treble_eq (-20.0);
+    apu.skip_ultrasonic (skipped != nullptr);
+    apu.quality (quality);
+    buf.bass_freq (461);
+    buf.clock_rate (clockRate);
+    buf.set_sample_rate (sampleRate);
+    apu.output (buf.center(), buf.left(), buf.right());
+
+    w.setup (apu);
+
+    blip_sample_t out[blockSize * 2];
+    clocks = 0;
+    int block = 0;
+
+    const auto start = bench::now();
+
+    for (long done = 0; done < samples; done += blockSize, block++)
+    {
+        if (w.block)
+            w.block (apu, block);
+
+        blip_time_t frame = buf.count_clocks (blockSize - buf.samples_avail());
+        bool stereo = apu.end_frame (frame);
+        buf.end_frame (frame, stereo);
+        clocks += frame;
+
+        buf.read_samples (out, blockSize);
+    }
+
+    double seconds = bench::secondsSince (start);
+    bench::consume (out[0]);
+    if (skipped)
+        *skipped = apu.skipped_transitions();
+    return seconds;
+}
+
+// Reads every workload's output both through Stereo_Buffer::read_samples(),
+// the reference, and through add_samples() into planar float, and checks they
+// are within 1 LSB of each other. With BLIP_BUFFER_WIDE add_samples() doesn't
+// clamp, so the float output is clamped here before comparing.
+static bool checkFloatRead (long sampleRate, int frames)
+{
+    for (auto& w : workloads)
+    {
+        Gb_Apu apus[2];
+        Stereo_Buffer bufs[2];
+        blip_sample_t out[blockSize * 2];
+        float left[blockSize], right[blockSize];
+
+        for (int i = 0; i < 2; i++)
+        {
+            apus[i].treble_eq (-20.0);
+            bufs[i].bass_freq (461);
+            bufs[i].clock_rate (clockRate);
+            bufs[i].set_sample_rate (sampleRate);
+            bufs[i].clear();
+            apus[i].output (bufs[i].center(), bufs[i].left(), bufs[i].right());
+            w.setup (apus[i]);
+        }
+
+        for (int f = 0; f < frames; f++)
+        {
+            const int count = blockSize - f % 7;
+
+            for (int i = 0; i < 2; i++)
+            {
+                if (w.block)
+                    w.block (apus[i], f);
+
+                blip_time_t frame = bufs[i].count_clocks (count - bufs[i].samples_avail());
+                bool stereo = apus[i].end_frame (frame);
+                bufs[i].end_frame (frame, stereo);
+            }
+
+            std::fill (left, left + count, 0.0f);
+            std::fill (right, right + count, 0.0f);
+
+            if (bufs[0].read_samples (out, count) != count || bufs[1].add_samples (left, right, count) != count)
+            {
+                printf ("MISMATCH %s at %ld Hz, frame %d: float read returned a different count\n", w.name, sampleRate, f);
+                return false;
+            }
+
+            for (int n = 0; n < count; n++)
+            {
+                const float l = std::max (-32768.0f, std::min (32767.0f, left[n] * 32768.0f));
+                const float r = std::max (-32768.0f, std::min (32767.0f, right[n] * 32768.0f));
+
+                if (std::abs (l - out[n * 2]) > 1.0f || std::abs (r - out[n * 2 + 1]) > 1.0f)
+                {
+                    printf ("MISMATCH %s at %ld Hz, frame %d, sample %d: float %g %g, int16 %d %d\n",
+                            w.name, sampleRate, f, n, l, r, out[n * 2], out[n * 2 + 1]);
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Changes treble and bass every few frames, on one chip directly between frames
+// and on the other the way a real-time thread would, with impulses prepared
+// during the frame and taken at its end_frame(), and a precalculated bass
+// shift. Checks the output matches exactly.
+static bool checkPreparedEq (long sampleRate, int frames)
+{
+    static const double trebles[] = { -8.0, -40.0, -3.0, -20.0 };
+    static const long cutoffs[] = { 8000, 0, 12000, 3000 };
+    static const int basses[] = { 90, 0, 1000, 461 };
+
+    for (auto& w : workloads)
+    {
+        Gb_Apu apus[2];
+        Stereo_Buffer bufs[2];
+        blip_sample_t out[2][blockSize * 2];
+
+        for (int i = 0; i < 2; i++)
+        {
+            apus[i].treble_eq (-20.0);
+            bufs[i].bass_freq (461);
+            bufs[i].clock_rate (clockRate);
+            bufs[i].set_sample_rate (sampleRate);
+            bufs[i].clear();
+            apus[i].output (bufs[i].center(), bufs[i].left(), bufs[i].right());
+            w.setup (apus[i]);
+        }
+
+        for (int f = 0; f < frames; f++)
+        {
+            const int change = f / 8 % 4;
+
+            if (f > 0 && f % 8 == 0)
+            {
+                apus[0].treble_eq (blip_eq_t (trebles[change], cutoffs[change], 44100));
+                bufs[0].bass_freq (basses[change]);
+                bufs[1].bass_freq (basses[change], Blip_Buffer::bass_shift_for (sampleRate, basses[change]));
+            }
+
+            for (int i = 0; i < 2; i++)
+            {
+                if (w.block)
+                    w.block (apus[i], f);
+
+                // prepared one frame ahead, so it's taken when the other chip switches
+                if (i == 1 && f % 8 == 7)
+                {
+                    const int next = (f + 1) / 8 % 4;
+                    apus[1].prepare_treble_eq (blip_eq_t (trebles[next], cutoffs[next], 44100));
+                }
+
+                blip_time_t frame = bufs[i].count_clocks (blockSize - bufs[i].samples_avail());
+                bool stereo = apus[i].end_frame (frame);
+                bufs[i].end_frame (frame, stereo);
+                bufs[i].read_samples (out[i], blockSize);
+            }
+
+            if (! std::equal (out[0], out[0] + blockSize * 2, out[1]))
+            {
+                printf ("MISMATCH %s at %ld Hz, frame %d: prepared equalization differs\n", w.name, sampleRate, f);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+#if BLIP_BUFFER_WIDE
+// Plays a chord on 16 chips with every channel at full volume, as PAPU's
+// largest voice pool can, through one shared bus, and compares it with the
+// sum of the same chips each mixed through a buffer of its own. The bus adds
+// them all up in one set of Blip_Buffers, so if those wrapped around the
+// difference would jump by a whole 16-bit range. Each buffer's integrator
+// rounds on its own, so the sum may be off by a sample or two per chip.
+static bool checkBusChord (long sampleRate, int frames)
+{
+    const int numChips = 16;
+
+    Gb_Apu bused[numChips], alone[numChips];
+    Stereo_Buffer bufs[numChips];
+    Gb_Apu_Bus bus;
+
+    for (int i = 0; i <= numChips; i++)
+    {
+        Stereo_Buffer& buf = i < numChips ? bufs[i] : bus.buffer();
+        buf.bass_freq (461);
+        buf.clock_rate (clockRate);
+        buf.set_sample_rate (sampleRate);
+        buf.clear();
+    }
+
+    for (int i = 0; i < numChips; i++)
+    {
+        bus.attach (bused[i]);
+        alone[i].output (bufs[i].center(), bufs[i].left(), bufs[i].right());
+
+        for (auto* apu : { &bused[i], &alone[i] })
+        {
+            apu->treble_eq (-20.0);
+            powerOn (*apu, true, 0x0f);
+            square (*apu, lowSquare - i * 8);
+            wave (*apu, waveFrequency - i * 4);
+            noise (*apu, slowNoise);
+        }
+    }
+
+    float busLeft[blockSize], busRight[blockSize];
+    float sumLeft[blockSize], sumRight[blockSize];
+    float peak = 0, worst = 0;
+
+    for (int f = 0; f < frames; f++)
+    {
+        blip_time_t frame = bus.buffer().count_clocks (blockSize - bus.buffer().samples_avail());
+
+        std::fill_n (busLeft, blockSize, 0.0f);
+        std::fill_n (busRight, blockSize, 0.0f);
+        std::fill_n (sumLeft, blockSize, 0.0f);
+        std::fill_n (sumRight, blockSize, 0.0f);
+
+        for (int i = 0; i < numChips; i++)
+            bus.add_to_frame (bused[i]);
+
+        bus.end_frame (frame);
+        bus.buffer().add_samples (busLeft, busRight, blockSize);
+
+        for (int i = 0; i < numChips; i++)
+        {
+            bool stereo = alone[i].end_frame (frame);
+            bufs[i].end_frame (frame, stereo);
+            bufs[i].add_samples (sumLeft, sumRight, blockSize);
+        }
+
+        for (int n = 0; n < blockSize; n++)
+        {
+            peak = std::max ({ peak, std::abs (busLeft[n]), std::abs (busRight[n]) });
+            worst = std::max ({ worst, std::abs (busLeft[n] - sumLeft[n]), std::abs (busRight[n] - sumRight[n]) });
+        }
+    }
+
+    if (worst * 32768 > 2 * numChips)
+    {
+        printf ("MISMATCH at %ld Hz: %d-chip chord on the bus is %.0f samples off the sum of the chips\n",
+                sampleRate, numChips, worst * 32768);
+        return false;
+    }
+
+    if (peak <= 1.0f)
+    {
+        printf ("MISMATCH at %ld Hz: %d-chip chord never went past full scale, so it checked nothing\n",
+                sampleRate, numChips);
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+// Prepares equalization on a second thread while end_frame() takes it as fast
+// as it can, then checks the last settings prepared are the ones in use by
+// comparing the chip's output with one given them through treble_eq()
+static bool checkPreparedEqThreads (long sampleRate, int prepares)
+{
+    static const double trebles[] = { -8.0, -40.0, -3.0, -20.0 };
+    static const long cutoffs[] = { 8000, 0, 12000, 3000 };
+
+    const auto& w = workloads[0];
+    const int last = (prepares - 1) % 4;
+
+    Gb_Apu apus[2];
+    apus[0].treble_eq (-20.0);
+    apus[0].output (nullptr);
+
+    std::atomic<bool> done { false };
+    std::thread preparer ([&]
+    {
+        for (int i = 0; i < prepares; i++)
+            apus[0].prepare_treble_eq (blip_eq_t (trebles[i % 4], cutoffs[i % 4], 44100));
+
+        done = true;
+    });
+
+    while (! done)
+        apus[0].end_frame (blockSize);
+
+    preparer.join();
+    apus[0].end_frame (blockSize);
+    apus[0].reset();
+
+    apus[1].treble_eq (blip_eq_t (trebles[last], cutoffs[last], 44100));
+
+    Stereo_Buffer bufs[2];
+    blip_sample_t out[2][blockSize * 2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        bufs[i].clock_rate (clockRate);
+        bufs[i].set_sample_rate (sampleRate);
+        bufs[i].clear();
+        apus[i].output (bufs[i].center(), bufs[i].left(), bufs[i].right());
+        w.setup (apus[i]);
+    }
+
+    for (int f = 0; f < 16; f++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            blip_time_t frame = bufs[i].count_clocks (blockSize - bufs[i].samples_avail());
+            bool stereo = apus[i].end_frame (frame);
+            bufs[i].end_frame (frame, stereo);
+            bufs[i].read_samples (out[i], blockSize);
+        }
+
+        if (! std::equal (out[0], out[0] + blockSize * 2, out[1]))
+        {
+            printf ("MISMATCH at %ld Hz after %d prepares on another thread: last equalization not in use\n", sampleRate, prepares);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+// Reference for the impulse loop: the raw buffer as 32-bit words, two 16-bit
+// samples each, or one sample in wide builds. Blip_Synth's arithmetic wraps
+// around on those words, so adding a transition changes each word by exactly
+// delta times what a delta of 1 at the same sub-sample phase changes it by.
+typedef std::vector<uint32_t> BufferWords;
+
+static BufferWords bufferWords (const Blip_Buffer& buf)
+{
+    BufferWords words ((buf.buffer_size_ + Blip_Buffer::widest_impulse_) * sizeof (Blip_Buffer::buf_t_) / 4);
+    memcpy (words.data(), buf.buffer_, words.size() * 4);
+    return words;
+}
+
+// Adds transitions with offset_resampled() at every one of the 64 sub-sample
+// phases and a spread of deltas, and checks each one against the reference,
+// worked out one word at a time. Any faster impulse loop has to pass this in
+// both 16-bit and wide builds.
+template <class Synth>
+static bool checkSynth (const char* name)
+{
+    Blip_Buffer buf, unit;
+    for (auto* b : { &buf, &unit })
+    {
+        b->clock_rate (clockRate);
+        b->set_sample_rate (48000, 50);
+        b->clear();
+    }
+
+    Synth synth;
+    synth.volume (0.15);
+    synth.treble_eq (-20.0);
+
+    const BufferWords cleared = bufferWords (unit);
+
+    const int deltas[] = { 1, -1, 15, -30, 105, -210, 210 };
+    const blip_resampled_time_t phaseStep = 1 << (BLIP_BUFFER_ACCURACY - blip_res_bits_);
+    const blip_resampled_time_t pairTime = blip_resampled_time_t (2) << BLIP_BUFFER_ACCURACY;
+
+    blip_resampled_time_t t = 0;
+    for (int phase = 0; phase < 64; phase++)
+    {
+        for (int delta : deltas)
+        {
+            // a different sample and fraction within the phase each time
+            const blip_resampled_time_t time = t + phase * phaseStep + (t & (phaseStep - 1));
+
+            // a delta of 1 at the same phase, in the first sample pair
+            unit.clear();
+            synth.offset_resampled (time % pairTime, 1, &unit);
+            const BufferWords one = bufferWords (unit);
+
+            BufferWords expected = bufferWords (buf);
+            const size_t shift = (time / pairTime) * 2 * sizeof (Blip_Buffer::buf_t_) / 4;
+            for (size_t i = 0; i + shift < expected.size(); i++)
+                expected[i + shift] += (one[i] - cleared[i]) * uint32_t (delta);
+
+            synth.offset_resampled (time, delta, &buf);
+
+            if (bufferWords (buf) != expected)
+            {
+                printf ("MISMATCH %s impulse of %d at phase %d differs from the reference\n", name, delta, phase);
+                return false;
+            }
+
+            t += (3 << BLIP_BUFFER_ACCURACY) + 777;
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+// Adds transitions at evenly spread sub-sample phases straight into a
+// Blip_Buffer, without any oscillator logic around them. With 256 per block
+// they are about two samples apart, so their impulses overlap.
+
+template <class Synth>
+static double runSynth (long sampleRate, long transitions, int perFrame = 256)
+{
+    Blip_Buffer buf;
+    buf.clock_rate (clockRate);
+    buf.set_sample_rate (sampleRate);
+
+    Synth synth;
+    synth.volume (0.15);
+    synth.treble_eq (-20.0);
+
+    const blip_time_t frame = buf.count_clocks (blockSize);
+    const blip_time_t step = frame / perFrame;
+
+    const auto start = bench::now();
+
+    int delta = 15;
+    for (long done = 0; done < transitions; done += perFrame)
+    {
+        blip_resampled_time_t t = buf.resampled_time (step / 3);
+        const blip_resampled_time_t resampledStep = buf.resampled_duration (int (step));
+
+        for (int i = 0; i < perFrame; i++)
+        {
+            delta = -delta;
+            synth.offset_resampled (t, delta, &buf);
+            t += resampledStep;
+        }
+
+        buf.end_frame (frame);
+        buf.remove_samples (buf.samples_avail());
+    }
+
+    return bench::secondsSince (start);
+}
+
+// Adds 'count' transitions 'step' apart to each buffer, starting at a
+// different sub-sample phase in each
+template <class Synth>
+static void addTransitions (const Synth& synth, Blip_Buffer* bufs, int numBuffers, int count, blip_time_t step)
+{
+    for (int b = 0; b < numBuffers; b++)
+    {
+        blip_resampled_time_t t = bufs[b].resampled_time (step / 3 + b * step / numBuffers);
+        const blip_resampled_time_t resampledStep = bufs[b].resampled_duration (int (step));
+
+        int delta = 15;
+        for (int i = 0; i < count; i++)
+        {
+            delta = -delta;
+            synth.offset_resampled (t, delta, &bufs[b]);
+            t += resampledStep;
+        }
+    }
+}
+
+// Times one oscillator type's synths at every quality tier, with transitions
+// about 21 samples apart. Each tier adds to 8 buffers of its own per frame, and
+// the tiers take turns frame by frame, starting with a different one each
+// time, so a change in the machine's speed hits them all alike. Only adding
+// the transitions is timed, not ending frames. Returns each tier's best
+// seconds for 'transitions' transitions.
+template <class Synths>
+static std::array<double, 4> runTiers (long sampleRate, long transitions)
+{
+    const int numBuffers = 8, perFrame = 24;
+    Blip_Buffer bufs[4][numBuffers];
+    for (auto& tier : bufs)
+    {
+        for (auto& buf : tier)
+        {
+            buf.clock_rate (clockRate);
+            buf.set_sample_rate (sampleRate);
+        }
+    }
+
+    Synths synths;
+    synths.volume (0.15);
+    synths.treble_eq (-20.0);
+
+    const blip_time_t frame = bufs[0][0].count_clocks (blockSize);
+    const blip_time_t step = frame / perFrame;
+    const long frames = std::max (1L, transitions / (perFrame * numBuffers));
+
+    std::array<double, 4> bestSeconds;
+    bestSeconds.fill (1e9);
+
+    for (int r = 0; r < repeats; r++)
+    {
+        std::array<double, 4> seconds {};
+
+        for (long f = 0; f < frames; f++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                const int q = int (f + i) % 4;
+                const auto start = bench::now();
+
+                switch (q)
+                {
+                    case gb_draft_quality: addTransitions (synths.draft, bufs[q], numBuffers, perFrame, step); break;
+                    case gb_high_quality:  addTransitions (synths.high, bufs[q], numBuffers, perFrame, step); break;
+                    case gb_ultra_quality: addTransitions (synths.ultra, bufs[q], numBuffers, perFrame, step); break;
+                    default:               addTransitions (synths.normal, bufs[q], numBuffers, perFrame, step); break;
+                }
+
+                seconds[size_t (q)] += bench::secondsSince (start);
+
+                for (auto& buf : bufs[q])
+                {
+                    buf.end_frame (frame);
+                    buf.remove_samples (buf.samples_avail());
+                }
+            }
+        }
+
+        for (size_t q = 0; q < 4; q++)
+            bestSeconds[q] = std::min (bestSeconds[q], seconds[q] * transitions / (frames * perFrame * numBuffers));
+    }
+
+    return bestSeconds;
+}
+
+//==============================================================================
+// The output stage on its own: integrating and clamping buffers that hold a
+// steady square wave, mono through one Blip_Buffer or all three mixed, read
+// in host blocks of the given size
+enum class Mix { blip, mono, stereo, stereoFloat };
+
+static double runMix (Mix mix, long sampleRate, long samples, int block = blockSize)
+{
+    Stereo_Buffer buf;
+    buf.clock_rate (clockRate);
+    buf.set_sample_rate (sampleRate);
+    buf.bass_freq (461);
+
+    Gb_Square::Synth synth;
+    synth.volume (0.15);
+
+    blip_sample_t out[blockSize * 2];
+    float left[blockSize], right[blockSize];
+
+    const blip_time_t frame = buf.count_clocks (block);
+    double seconds = 0;
+
+    for (long done = 0; done < samples; done += block)
+    {
+        // keep the buffers busy so the integrators never settle
+        synth.offset (0, 30, buf.center());
+        synth.offset (frame / 2, -30, buf.center());
+
+        if (mix != Mix::blip && mix != Mix::mono)
+        {
+            synth.offset (frame / 3, 30, buf.left());
+            synth.offset (frame / 3 * 2, -30, buf.left());
+        }
+
+        buf.end_frame (frame, mix != Mix::mono);
+
+        const auto start = bench::now();
+
+        switch (mix)
+        {
+            case Mix::blip:
+                buf.center()->read_samples (out, block);
+                buf.left()->remove_silence (block);
+                buf.right()->remove_silence (block);
+                break;
+            case Mix::mono:
+            case Mix::stereo:
+                buf.read_samples (out, block);
+                break;
+            case Mix::stereoFloat:
+                std::fill_n (left, block, 0.0f);
+                std::fill_n (right, block, 0.0f);
+                buf.add_samples (left, right, block);
+                break;
+        }
+
+        seconds += bench::secondsSince (start);
+    }
+
+    // only the mix's own output has been written
+    if (mix == Mix::stereoFloat)
+        bench::consume (left[0]);
+    else
+        bench::consume (out[0]);
+
+    return seconds;
+}
+
+//==============================================================================
+// Several chips playing detuned stereo squares, each into its own
+// Stereo_Buffer summed as floats the way separate voices were, or all
+// into one shared bus which is read once
+static double runChips (bool shared, int numChips, long sampleRate, long samples)
+{
+    Gb_Apu apus[Gb_Apu_Bus::max_apus];
+    Stereo_Buffer bufs[Gb_Apu_Bus::max_apus];
+    Gb_Apu_Bus bus;
+
+    const int numBufs = shared ? 1 : numChips;
+
+    for (int i = 0; i < numBufs; i++)
+    {
+        Stereo_Buffer& buf = shared ? bus.buffer() : bufs[i];
+        buf.bass_freq (461);
+        buf.clock_rate (clockRate);
+        buf.set_sample_rate (sampleRate);
+    }
+
+    for (int i = 0; i < numChips; i++)
+    {
+        apus[i].treble_eq (-20.0);
+
+        if (shared)
+            bus.attach (apus[i]);
+        else
+            apus[i].output (bufs[i].center(), bufs[i].left(), bufs[i].right());
+
+        powerOn (apus[i], true, 3);
+        square (apus[i], lowSquare - i);
+    }
+
+    float left[blockSize], right[blockSize];
+    Stereo_Buffer& first = shared ? bus.buffer() : bufs[0];
+
+    const auto start = bench::now();
+
+    for (long done = 0; done < samples; done += blockSize)
+    {
+        blip_time_t frame = first.count_clocks (blockSize - first.samples_avail());
+
+        std::fill_n (left, blockSize, 0.0f);
+        std::fill_n (right, blockSize, 0.0f);
+
+        if (shared)
+        {
+            for (int i = 0; i < numChips; i++)
+                bus.add_to_frame (apus[i]);
+
+            bus.end_frame (frame);
+            bus.buffer().add_samples (left, right, blockSize);
+        }
+        else
+        {
+            for (int i = 0; i < numChips; i++)
+            {
+                bool stereo = apus[i].end_frame (frame);
+                bufs[i].end_frame (frame, stereo);
+                bufs[i].add_samples (left, right, blockSize);
+            }
+        }
+    }
+
+    double seconds = bench::secondsSince (start);
+    bench::consume (left[0]);
+    return seconds;
+}
+
+//==============================================================================
+// Creates numChips chips set up the way PAPUEngine does, as a session with
+// many plugin instances would, and returns the time taken. tableBytes gets
+// the size of the impulse tables they share.
+static double runConstruct (int numChips, long& tableBytes)
+{
+    std::vector<std::unique_ptr<Gb_Apu>> apus;
+    apus.reserve (size_t (numChips));
+
+    const auto start = bench::now();
+
+    for (int i = 0; i < numChips; i++)
+    {
+        apus.emplace_back (new Gb_Apu);
+        apus.back()->treble_eq (-20.0);
+    }
+
+    double seconds = bench::secondsSince (start);
+    tableBytes = Blip_Impulse_::shared_bytes();
+    return seconds;
+}
+
+//==============================================================================
+template <class Fn>
+static double best (Fn fn)
+{
+    double t = 1e9;
+    for (int r = 0; r < repeats; r++)
+        t = std::min (t, fn());
+    return t;
+}
+
+int main (int argc, char** argv)
+{
+    if (! checkSynth<Gb_Square::Synth> ("square") || ! checkSynth<Gb_Wave::Synth> ("wave"))
+        return 1;
+
+    printf ("Blip_Synth impulses match the scalar reference at all 64 phases\n");
+
+    if (! checkNoiseSteps())
+        return 1;
+
+    printf ("Noise LFSR multi-step update matches single steps\n");
+
+    for (long rate : sampleRates)
+        if (! checkFloatRead (rate, bench::scaled (argc, argv, 200)))
+            return 1;
+
+    printf ("Planar float output is within 1 LSB of read_samples()\n");
+
+    for (long rate : sampleRates)
+        if (! checkPreparedEq (rate, bench::scaled (argc, argv, 200)))
+            return 1;
+
+    printf ("Equalization prepared ahead and taken at end_frame matches treble_eq\n");
+
+    for (long rate : sampleRates)
+        if (! checkPreparedEqThreads (rate, bench::scaled (argc, argv, 400)))
+            return 1;
+
+    printf ("The last equalization prepared on another thread is the one taken\n");
+
+    // PAPU builds with wide buffers, since 16-bit ones would wrap around here
+    #if BLIP_BUFFER_WIDE
+    for (long rate : sampleRates)
+        if (! checkBusChord (rate, bench::scaled (argc, argv, 50)))
+            return 1;
+
+    printf ("A 16-voice chord at full volume doesn't wrap around on the shared bus\n");
+    #endif
+
+    printf ("\n");
+
+    const double audioSeconds = bench::scaled (argc, argv, 1000) / 1000.0;
+
+    printf ("Oscillators through Gb_Apu, %.2f s of audio per run\n", audioSeconds);
+    printf ("%-14s %7s %10s %14s %12s\n", "workload", "rate", "ns/sample", "transitions/s", "ns/trans");
+
+    for (auto& w : workloads)
+    {
+        for (long rate : sampleRates)
+        {
+            const long samples = long (audioSeconds * rate);
+            long clocks = 0;
+            const double t = best ([&] { return runApu (w, rate, samples, clocks); });
+            const long transitions = w.transitions (clocks);
+
+            printf ("%-14s %7ld %10.2f %14.0f", w.name, rate, t * 1e9 / samples, transitions / t);
+            if (transitions > 0)
+                printf (" %12.2f\n", t * 1e9 / transitions);
+            else
+                printf (" %12s\n", "-");
+        }
+    }
+
+    printf ("\nUltrasonic squares and wave synthesised or skipped, ns/sample\n");
+    printf ("%-14s %7s %12s %12s %14s\n", "workload", "rate", "synthesised", "skipped", "skipped/all trans");
+
+    for (auto& w : ultrasonicWorkloads)
+    {
+        for (long rate : ultrasonicRates)
+        {
+            const long samples = long (audioSeconds * rate);
+            long clocks = 0, skipped = 0;
+            const double a = best ([&] { return runApu (w, rate, samples, clocks); });
+            const double b = best ([&] { return runApu (w, rate, samples, clocks, &skipped); });
+            printf ("%-14s %7ld %12.2f %12.2f %8ld / %-8ld\n", w.name, rate, a * 1e9 / samples, b * 1e9 / samples,
+                    skipped, w.transitions (clocks));
+        }
+    }
+
+    printf ("\nBlip_Synth::offset_resampled\n");
+    printf ("%-14s %7s %12s %14s\n", "quality", "rate", "ns/trans", "transitions/s");
+
+    const long transitions = bench::scaled (argc, argv, 2000000);
+
+    for (long rate : sampleRates)
+    {
+        const double good = best ([&] { return runSynth<Gb_Square::Synth> (rate, transitions); });
+        const double med  = best ([&] { return runSynth<Gb_Wave::Synth> (rate, transitions); });
+
+        printf ("%-14s %7ld %12.2f %14.0f\n", "good (square)", rate, good * 1e9 / transitions, transitions / good);
+        printf ("%-14s %7ld %12.2f %14.0f\n", "med (wave)", rate, med * 1e9 / transitions, transitions / med);
+    }
+
+    printf ("\nQuality tiers at 48000 Hz, ns/trans about 21 samples apart and all stereo ns/sample\n");
+    printf ("%-14s %12s %12s %12s\n", "tier", "square", "wave/noise", "all stereo");
+
+    {
+        const auto squares = runTiers<Gb_Square::Synths> (48000, transitions);
+        const auto others  = runTiers<Gb_Wave::Synths> (48000, transitions);
+
+        // the tiers take turns here too, a whole run each
+        const Workload& stereo = workloads[sizeof workloads / sizeof workloads[0] - 1]; // all stereo
+        const long samples = long (audioSeconds * 48000);
+        std::array<double, 4> apus;
+        apus.fill (1e9);
+
+        for (int r = 0; r < repeats; r++)
+        {
+            for (int q = gb_draft_quality; q <= gb_ultra_quality; q++)
+            {
+                long clocks = 0;
+                apus[size_t (q)] = std::min (apus[size_t (q)], runApu (stereo, 48000, samples, clocks, nullptr, q));
+            }
+        }
+
+        const char* const names[] = { "draft", "normal", "high", "ultra" };
+
+        for (size_t q = 0; q < 4; q++)
+            printf ("%-14s %12.2f %12.2f %12.2f\n", names[q], squares[q] * 1e9 / transitions,
+                    others[q] * 1e9 / transitions, apus[q] * 1e9 / samples);
+    }
+
+    printf ("\nOutput stage, Blip_Buffer::read_samples and Stereo_Buffer mixing\n");
+    printf ("%-14s %7s %10s\n", "mix", "rate", "ns/sample");
+
+    const struct { Mix mix; const char* name; } mixes[] =
+    {
+        { Mix::blip,        "blip mono" },
+        { Mix::mono,        "mono" },
+        { Mix::stereo,      "stereo" },
+        { Mix::stereoFloat, "stereo float" },
+    };
+
+    for (auto& m : mixes)
+    {
+        for (long rate : sampleRates)
+        {
+            const long samples = long (audioSeconds * rate) * 4;
+            const double t = best ([&] { return runMix (m.mix, rate, samples); });
+            printf ("%-14s %7ld %10.2f\n", m.name, rate, t * 1e9 / samples);
+        }
+    }
+
+    printf ("\nOutput stage by host block size, stereo float at 48000 Hz\n");
+    printf ("%-14s %7s %10s\n", "mix", "block", "ns/sample");
+
+    for (int block : { 16, 64, 256, blockSize })
+    {
+        const long samples = long (audioSeconds * 48000) * 4;
+        const double t = best ([&] { return runMix (Mix::stereoFloat, 48000, samples, block); });
+        printf ("%-14s %7d %10.2f\n", "stereo float", block, t * 1e9 / samples);
+    }
+
+    printf ("\nSeveral chips, a Stereo_Buffer each or one shared Gb_Apu_Bus, at 48000 Hz\n");
+    printf ("%-14s %7s %10s %12s\n", "mix", "chips", "ns/sample", "ns/chip");
+
+    for (int chips : { 1, 4, 8, 16 })
+    {
+        for (bool shared : { false, true })
+        {
+            const long samples = long (audioSeconds * 48000);
+            const double t = best ([&] { return runChips (shared, chips, 48000, samples); });
+            printf ("%-14s %7d %10.2f %12.2f\n", shared ? "shared bus" : "buffer each", chips,
+                    t * 1e9 / samples, t * 1e9 / samples / chips);
+        }
+    }
+
+    printf ("\nChip construction, Gb_Apu is %d bytes plus shared impulse tables\n", int (sizeof (Gb_Apu)));
+    printf ("%-14s %7s %10s %12s\n", "", "chips", "us/chip", "table bytes");
+
+    for (int chips : { 1, 16, 64 })
+    {
+        long tableBytes = 0;
+        const double t = best ([&] { return runConstruct (chips, tableBytes); });
+        printf ("%-14s %7d %10.2f %12ld\n", "Gb_Apu", chips, t * 1e6 / chips, tableBytes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+  ==============================================================================
+
+    Compares the old std::map register cache used by PAPUAudioProcessor with
+    Gb_Shadow_Regs, driving both with the register traffic of a dense MIDI
+    stream: every block rewrites the full patch, most events retrigger.
+
+    Then times wave table switches while the wave channel plays, with the
+    16 bytes of wave RAM written one register at a time or all at once
+    with Gb_Apu::write_wave_ram(), after checking the two sound the same.
+
+  ==============================================================================
+*/
+
+#include "gb_apu/Gb_Apu.h"
+#include "gb_apu/Multi_Buffer.h"
+#include "gb_apu/Gb_Shadow_Regs.h"
+
+#include "bench.h"
+
+#include <map>
+#include <vector>
+
+//==============================================================================
+// The register writes runOscs() makes for one note
+struct PatchWrites
+{
+    int addr[15];
+    int value[15];
+    int count = 0;
+
+    void add (int a, int v) { addr[count] = a; value[count] = v; count++; }
+};
+
+static PatchWrites makeNote (int note, bool trigger)
+{
+    PatchWrites w;
+    int period = 2048 - (131072 / (8 << (note / 12))) + note % 12;
+    period &= 0x7ff;
+
+    w.add (0xff10, 0x00);
+    w.add (0xff11, 0x80);
+    w.add (0xff13, period & 0xff);
+    w.add (0xff12, 0xf0);
+    w.add (0xff14, (trigger ? 0x80 : 0x00) | (period >> 8));
+    w.add (0xff16, 0x40);
+    w.add (0xff18, (period + 3) & 0xff);
+    w.add (0xff17, 0xf0);
+    w.add (0xff19, (trigger ? 0x80 : 0x00) | ((period + 3) >> 8 & 7));
+    w.add (0xff21, 0xf1);
+    w.add (0xff22, 0x31);
+    w.add (0xff23, trigger ? 0x80 : 0x00);
+    w.add (0xff24, 0x0f);
+    w.add (0xff25, 0x33);
+    return w;
+}
+
+//==============================================================================
+// The cache PAPUAudioProcessor::writeReg used before Gb_Shadow_Regs
+struct MapCache
+{
+    std::map<int, int> regCache;
+    gb_time_t time = 0;
+
+    void write (Gb_Apu& apu, int reg, int value, bool force)
+    {
+        auto itr = regCache.find (reg);
+        if (force || itr == regCache.end() || itr->second != value)
+        {
+            regCache[reg] = value;
+            apu.write_register (time += 4, gb_addr_t (reg), value);
+        }
+    }
+
+    void flush (Gb_Apu&) {}
+};
+
+struct ShadowCache
+{
+    Gb_Shadow_Regs regs;
+    gb_time_t time = 0;
+
+    void write (Gb_Apu&, int reg, int value, bool force)
+    {
+        regs.write (gb_addr_t (reg), value, force);
+    }
+
+    void flush (Gb_Apu& apu)
+    {
+        time = regs.flush (apu, time, 4);
+    }
+};
+
+//==============================================================================
+template <class Cache>
+static double run (bool withOutput, int blocks, int eventsPerBlock, long& writes)
+{
+    Gb_Apu apu;
+    Stereo_Buffer buf;
+    buf.clock_rate (4194304);
+    buf.set_sample_rate (44100);
+
+    if (withOutput)
+        apu.output (buf.center(), buf.left(), buf.right());
+
+    Cache cache;
+    cache.write (apu, 0xff26, 0x8f, true);
+    cache.flush (apu);
+
+    unsigned seed = 1;
+    int note = 60;
+    const auto start = bench::now();
+
+    for (int b = 0; b < blocks; b++)
+    {
+        // start of block: the whole patch is written again, nearly all redundant
+        PatchWrites w = makeNote (note, false);
+        for (int i = 0; i < w.count; i++)
+            cache.write (apu, w.addr[i], w.value[i], false);
+        cache.flush (apu);
+
+        for (int e = 0; e < eventsPerBlock; e++)
+        {
+            seed = seed * 1103515245 + 12345;
+            const bool trigger = (seed >> 16) % 4 != 0;
+            if (trigger)
+                note = 36 + int ((seed >> 8) % 48);
+
+            w = makeNote (note, trigger);
+            for (int i = 0; i < w.count; i++)
+                cache.write (apu, w.addr[i], w.value[i], trigger);
+            cache.flush (apu);
+        }
+
+        // one 64 sample block of clocks, then start a new frame
+        bool stereo = apu.end_frame (6087);
+        buf.end_frame (6087, stereo);
+        cache.time = 0;
+
+        blip_sample_t out[1024];
+        while (buf.samples_avail() > 0)
+            buf.read_samples (out, 512);
+    }
+
+    writes = long (blocks) * (1 + eventsPerBlock) * 14;
+    return bench::secondsSince (start);
+}
+
+//==============================================================================
+static const BOOST::uint8_t waveTables[2][Gb_Apu::wave_ram_size] =
+{
+    { 0x8a, 0xbc, 0xde, 0xff, 0xff, 0xed, 0xcb, 0xa8, 0x75, 0x43, 0x21, 0x00, 0x00, 0x12, 0x34, 0x57 },
+    { 0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00 },
+};
+
+static void writeWaveTable (Gb_Apu& apu, gb_time_t time, int table, bool bulk, int step)
+{
+    if (bulk)
+    {
+        apu.write_wave_ram (time, waveTables[table]);
+        return;
+    }
+
+    for (int i = 0; i < Gb_Apu::wave_ram_size; i++)
+        apu.write_register (time + i * step, gb_addr_t (Gb_Apu::wave_ram_addr + i), waveTables[table][i]);
+}
+
+// The wave channel plays a note while its table is switched 'switches' times
+// per 64 sample block. With 'step' clocks between one by one writes, as
+// Gb_Shadow_Regs::flush() makes them at power-on.
+static double runWaveTables (bool bulk, int step, int blocks, int switches, blip_sample_t* out)
+{
+    Gb_Apu apu;
+    Stereo_Buffer buf;
+    buf.clock_rate (4194304);
+    buf.set_sample_rate (44100);
+    apu.output (buf.center(), buf.left(), buf.right());
+
+    apu.write_register (0, 0xff26, 0x80);
+    apu.write_register (0, 0xff24, 0x77);
+    apu.write_register (0, 0xff25, 0x44);
+    writeWaveTable (apu, 0, 0, bulk, 0);
+    apu.write_register (0, 0xff1a, 0x80);
+    apu.write_register (0, 0xff1c, 0x20);
+    apu.write_register (0, 0xff1d, 0x80);
+    apu.write_register (0, 0xff1e, 0x87);
+
+    const auto start = bench::now();
+
+    for (int b = 0; b < blocks; b++)
+    {
+        for (int e = 0; e < switches; e++)
+            writeWaveTable (apu, 6000 / switches * e, (b * switches + e) & 1, bulk, step);
+
+        bool stereo = apu.end_frame (6087);
+        buf.end_frame (6087, stereo);
+
+        while (buf.samples_avail() > 0)
+            out += buf.read_samples (out, 512) * 2;
+    }
+
+    return bench::secondsSince (start);
+}
+
+int main (int argc, char** argv)
+{
+    const int blocks = bench::scaled (argc, argv, 20000);
+
+    {
+        // 16 writes at the same time must sound exactly like one bulk write
+        std::vector<blip_sample_t> a (size_t (blocks) * 160), b (a.size());
+        runWaveTables (false, 0, blocks, 4, a.data());
+        runWaveTables (true, 0, blocks, 4, b.data());
+        if (a != b)
+        {
+            printf ("MISMATCH write_wave_ram() differs from 16 write_register()\n");
+            return 1;
+        }
+
+        printf ("write_wave_ram() matches 16 write_register() at the same time\n\n");
+    }
+
+    printf ("%-8s %-7s %8s %14s %14s %8s\n", "output", "events", "blocks", "map ns/write", "shadow ns/write", "speedup");
+
+    for (bool withOutput : { false, true })
+    {
+        for (int events : { 1, 4, 16 })
+        {
+            long writes = 0;
+            double mapTime = 1e9, shadowTime = 1e9;
+
+            for (int r = 0; r < 5; r++)
+            {
+                mapTime    = std::min (mapTime,    run<MapCache>    (withOutput, blocks, events, writes));
+                shadowTime = std::min (shadowTime, run<ShadowCache> (withOutput, blocks, events, writes));
+            }
+
+            printf ("%-8s %-7d %8d %14.2f %14.2f %7.2fx\n", withOutput ? "stereo" : "none", events, blocks,
+                    mapTime * 1e9 / writes, shadowTime * 1e9 / writes, mapTime / shadowTime);
+        }
+    }
+
+    printf ("\nWave table switches while the wave channel plays, ns per switch\n");
+    printf ("%-8s %8s %16s %16s %16s %8s\n", "switches", "blocks", "16 same ns", "16 spaced ns", "bulk ns", "speedup");
+
+    for (int switches : { 1, 4, 16 })
+    {
+        std::vector<blip_sample_t> out (size_t (blocks) * 160);
+        double same = 1e9, spaced = 1e9, bulk = 1e9;
+
+        for (int r = 0; r < 5; r++)
+        {
+            same   = std::min (same,   runWaveTables (false, 0, blocks, switches, out.data()));
+            spaced = std::min (spaced, runWaveTables (false, 4, blocks, switches, out.data()));
+            bulk   = std::min (bulk,   runWaveTables (true,  0, blocks, switches, out.data()));
+        }
+
+        const double n = double (blocks) * switches;
+        printf ("%-8d %8d %16.2f %16.2f %16.2f %7.2fx\n", switches, blocks,
+                same * 1e9 / n, spaced * 1e9 / n, bulk * 1e9 / n, spaced / bulk);
+    }
+
+    return 0;
+}
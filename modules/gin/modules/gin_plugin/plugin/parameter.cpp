@@ -25,12 +25,12 @@ bool Parameter::isOnOff()
 
 float Parameter::getUserValue() const
 {
-    return jlimit (range.start, range.end, value);
+    return jlimit (range.start, range.end, value.load());
 }
 
 int Parameter::getUserValueInt() const
 {
-    return int (jlimit (range.start, range.end, value));
+    return int (jlimit (range.start, range.end, value.load()));
 }
 
 float Parameter::getUserDefaultValue() const
@@ -38,21 +38,22 @@ float Parameter::getUserDefaultValue() const
     return defaultValue;
 }
 
-void Parameter::setUserValue (float v)
+void Parameter::setUserValue (float v, NotificationType notification)
 {
     v = jlimit(range.start, range.end, range.snapToLegalValue (v));
-    if (! almostEqual (value, v))
+    if (! almostEqual (value.load(), v))
     {
         value = v;
 
-        triggerAsyncUpdate();
+        if (notification != dontSendNotification)
+            triggerAsyncUpdate();
     }
 }
 
 void Parameter::setUserValueNotifingHost (float v)
 {
     v = jlimit (range.start, range.end, range.snapToLegalValue (v));
-    if (! almostEqual (value, v))
+    if (! almostEqual (value.load(), v))
     {
         value = v;
         setValueNotifyingHost (getValue());
@@ -141,7 +142,7 @@ void Parameter::setState (const ParamState& state)
 
 float Parameter::getValue() const
 {
-    return jlimit (0.0f, 1.0f, range.convertTo0to1 (value));
+    return jlimit (0.0f, 1.0f, range.convertTo0to1 (value.load()));
 }
 
 void Parameter::setValue (float valueIn)
@@ -149,7 +150,7 @@ void Parameter::setValue (float valueIn)
     valueIn = jlimit (0.0f, 1.0f, valueIn);
     float newValue = range.snapToLegalValue (range.convertFrom0to1 (valueIn));
 
-    if (! almostEqual(value, newValue))
+    if (! almostEqual (value.load(), newValue))
     {
         value = newValue;
         triggerAsyncUpdate();
@@ -16,7 +16,9 @@ public:
     float getUserValue() const;
     int getUserValueInt() const;
     float getUserDefaultValue() const;
-    void setUserValue (float v);
+    /** Listeners are told asynchronously unless notification is
+        dontSendNotification. The host is never told. */
+    void setUserValue (float v, NotificationType notification = sendNotificationAsync);
     void setUserValueNotifingHost (float f);
     void setUserValueAsUserAction (float f);
     String getUserValueText() const;
@@ -82,7 +84,7 @@ protected:
     //==============================================================================
     NormalisableRange<float> range;
 
-    float value;
+    std::atomic<float> value;
     float defaultValue;
     float skewFactor;
 
@@ -14,9 +14,18 @@
 //==============================================================================
 GinProcessor::GinProcessor()
 {
-    LookAndFeel::setDefaultLookAndFeel (&lookAndFeel);
+    // a processor created outside a plugin wrapper, e.g. by an offline
+    // renderer, has no UI and may be running without a display
+    if (wrapperType != wrapperType_Undefined)
+    {
+        LookAndFeel::setDefaultLookAndFeel (&lookAndFeel);
+        ownsDefaultLookAndFeel = true;
+    }
 
-    properties = std::make_unique<PropertiesFile> (getSettingsFile(), PropertiesFile::Options());
+    // the settings file is shared by every instance, and nothing headless
+    // reads it, so several processors rendering at once don't all open it
+    if (wrapperType != wrapperType_Undefined)
+        properties = std::make_unique<PropertiesFile> (getSettingsFile(), PropertiesFile::Options());
 
     loadAllPrograms();
 
@@ -27,8 +36,11 @@ GinProcessor::GinProcessor()
 
 GinProcessor::~GinProcessor()
 {
-    MessageManagerLock mmLock;
-    LookAndFeel::setDefaultLookAndFeel (nullptr);
+    if (ownsDefaultLookAndFeel)
+    {
+        MessageManagerLock mmLock;
+        LookAndFeel::setDefaultLookAndFeel (nullptr);
+    }
 }
 
 std::unique_ptr<PropertiesFile> GinProcessor::getSettings()
@@ -46,42 +58,46 @@ std::unique_ptr<PropertiesFile> GinProcessor::getSettings()
 }
 
 //==============================================================================
-void GinProcessor::addPluginParameter (Parameter* parameter)
+int GinProcessor::addPluginParameter (Parameter* parameter)
 {
     addParameter (parameter);
 
     parameterMap[parameter->getUid()] = parameter;
+    pluginParameters.add (parameter);
+    snapshot.values.add (parameter->getUserValue());
+
+    return pluginParameters.size() - 1;
 }
 
 Parameter* GinProcessor::getParameter (const String& uid)
 {
-    if (parameterMap.find (uid) != parameterMap.end())
-        return parameterMap[uid];
+    auto itr = parameterMap.find (uid);
+    if (itr != parameterMap.end())
+        return itr->second;
 
     return nullptr;
 }
 
 float GinProcessor::parameterValue (const String& uid)
 {
-    if (parameterMap.find (uid) != parameterMap.end())
-        return parameterMap[uid]->getUserValue();
+    if (auto p = getParameter (uid))
+        return p->getUserValue();
 
     return 0;
-
 }
 
 int GinProcessor::parameterIntValue (const String& uid)
 {
-    if (parameterMap.find (uid) != parameterMap.end())
-        return int (parameterMap[uid]->getUserValue());
+    if (auto p = getParameter (uid))
+        return int (p->getUserValue());
 
     return 0;
 }
 
 bool GinProcessor::parameterBoolValue (const String& uid)
 {
-    if (parameterMap.find (uid) != parameterMap.end())
-        return parameterMap[uid]->getUserValue() > 0;
+    if (auto p = getParameter (uid))
+        return p->getUserValue() > 0;
 
     return 0;
 }
@@ -90,7 +106,7 @@ Array<Parameter*> GinProcessor::getPluginParameters()
 {
     Array<Parameter*> result;
 
-    auto params = getParameters();
+    auto& params = getParameters();
     for (auto p : params)
         if (auto pp = dynamic_cast<Parameter*>(p))
             result.add (pp);
@@ -98,6 +114,42 @@ Array<Parameter*> GinProcessor::getPluginParameters()
     return result;
 }
 
+int GinProcessor::getParameterIndex (const String& uid)
+{
+    return pluginParameters.indexOf (getParameter (uid));
+}
+
+Parameter* GinProcessor::getPluginParameter (int index)
+{
+    return pluginParameters[index];
+}
+
+float GinProcessor::parameterValue (int index)
+{
+    return pluginParameters.getUnchecked (index)->getUserValue();
+}
+
+int GinProcessor::parameterIntValue (int index)
+{
+    return int (pluginParameters.getUnchecked (index)->getUserValue());
+}
+
+bool GinProcessor::parameterBoolValue (int index)
+{
+    return pluginParameters.getUnchecked (index)->getUserValue() > 0;
+}
+
+const GinProcessor::ParameterSnapshot& GinProcessor::updateParameterSnapshot()
+{
+    auto params = pluginParameters.begin();
+    auto values = snapshot.values.begin();
+
+    for (int i = pluginParameters.size(); --i >= 0;)
+        *values++ = (*params++)->getUserValue();
+
+    return snapshot;
+}
+
 //==============================================================================
 const String GinProcessor::getName() const
 {
@@ -19,13 +19,41 @@ public:
     //==============================================================================
     using AudioProcessor::getParameter;
 
-    void addPluginParameter (Parameter* parameter);
+    /** Adds a parameter and returns its index, which can be used as a handle
+        to look it up again without going through its uid. */
+    int addPluginParameter (Parameter* parameter);
     Parameter* getParameter (const String& uid);
     float parameterValue (const String& uid);
     int parameterIntValue (const String& uid);
     bool parameterBoolValue (const String& uid);
     Array<Parameter*> getPluginParameters();
 
+    int getParameterIndex (const String& uid);
+    Parameter* getPluginParameter (int index);
+    float parameterValue (int index);
+    int parameterIntValue (int index);
+    bool parameterBoolValue (int index);
+
+    //==============================================================================
+    /** The user values of all plugin parameters, copied in one pass. Refresh it
+        at the start of processBlock with updateParameterSnapshot() and the audio
+        thread can then read values by index without string lookups or allocation.
+    */
+    class ParameterSnapshot
+    {
+    public:
+        float getValue (int index) const     { return values[index];        }
+        int getIntValue (int index) const    { return int (values[index]);  }
+        bool getBoolValue (int index) const  { return values[index] > 0;    }
+
+    private:
+        friend class GinProcessor;
+        Array<float> values;
+    };
+
+    const ParameterSnapshot& updateParameterSnapshot();
+    const ParameterSnapshot& getParameterSnapshot() const   { return snapshot; }
+
     File getProgramDirectory();
     File getSettingsFile();
 
@@ -60,6 +88,7 @@ public:
     std::unique_ptr<PropertiesFile> properties;
 
     std::map<String, Parameter*> parameterMap;
+    Array<Parameter*> pluginParameters;
 
     ValueTree state;
 
@@ -71,6 +100,9 @@ private:
     void updateParams();
 
     LookAndFeel_V3 lookAndFeel;
+    bool ownsDefaultLookAndFeel = false;
+
+    ParameterSnapshot snapshot;
 
     int currentProgram = 0;
     OwnedArray<GinProgram> programs;
@@ -1,10 +1,18 @@
 #include "program.h"
 #include "processor.h"
 
-void GinProgram::loadProcessor (GinProcessor* p)
+void GinProgram::loadProcessor (GinProcessor* p, bool notify)
 {
+    auto setValue = [notify] (Parameter* pp, float v)
+    {
+        if (notify)
+            pp->setUserValueNotifingHost (v);
+        else
+            pp->setUserValue (v, dontSendNotification);
+    };
+
     for (auto pp : p->getPluginParameters())
-        pp->setUserValueNotifingHost (pp->getUserDefaultValue());
+        setValue (pp, pp->getUserDefaultValue());
 
     int w = p->state.getProperty ("width", -1);
     int h = p->state.getProperty ("height", -1);
@@ -28,7 +36,7 @@ void GinProgram::loadProcessor (GinProcessor* p)
     for (Parameter::ParamState state : states)
         if (auto pp = p->getParameter (state.uid))
             if (! pp->isMetaParameter())
-                pp->setUserValueNotifingHost (state.value);
+                setValue (pp, state.value);
 }
 
 void GinProgram::saveProcessor (GinProcessor* p)
@@ -8,7 +8,9 @@ class GinProcessor;
 class GinProgram
 {
 public:
-    void loadProcessor (GinProcessor* p);
+    /** With notify false, parameters are set without telling the host or
+        posting messages, for processors that run without a message loop. */
+    void loadProcessor (GinProcessor* p, bool notify = true);
     void saveProcessor (GinProcessor* p);
 
     void loadFromFile (File f);
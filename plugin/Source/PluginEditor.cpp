@@ -36,17 +36,18 @@ PAPUAudioProcessorEditor::PAPUAudioProcessorEditor (PAPUAudioProcessor& p)
         controls.add (c);
     }
     
-    setGridSize (13, 3);
+    setGridSize (14, 4);
     
     scope.setNumSamplesPerPixel (2);
     scope.setVerticalZoomFactor (3.0f);
 
-    p.setEditor (this);
+    p.setScopeAttached (true);
+    startTimerHz (60);
 }
 
 PAPUAudioProcessorEditor::~PAPUAudioProcessorEditor()
 {
-    processor.setEditor (nullptr);
+    processor.setScopeAttached (false);
 }
 
 //==============================================================================
@@ -57,45 +58,41 @@ void PAPUAudioProcessorEditor::paint (Graphics& g)
     g.drawImageAt (logo, getWidth() / 2 - logo.getWidth() / 2, 0);
 }
 
+void PAPUAudioProcessorEditor::timerCallback()
+{
+    const int numSamples = processor.readScopeSamples (scopeSamples, PAPUAudioProcessor::scopeRingSize);
+    if (numSamples > 0)
+        scope.addSamples (scopeSamples, numSamples);
+}
+
 void PAPUAudioProcessorEditor::resized()
 {
     using AP = PAPUAudioProcessor;
     
     GinAudioProcessorEditor::resized();
     
-    for (int i = 0; i < 9; i++)
+    // a channel's output switches share the first column, and the rest of
+    // its controls follow in parameter order
+    auto layoutChannel = [this] (int row, int first, int last)
     {
-        auto* c = controls[i];
-        if (i == 0)
-            c->setBounds (getGridArea (0, 0).removeFromTop (cy / 2).translated (0, 7));
-        else if (i == 1)
-            c->setBounds (getGridArea (0, 0).removeFromBottom (cy / 2));
-        else
-            c->setBounds (getGridArea (i - 1, 0));
+        controls[first]->setBounds (getGridArea (0, row).removeFromTop (cy / 2).translated (0, 7));
+        controls[first + 1]->setBounds (getGridArea (0, row).removeFromBottom (cy / 2));
         
-    }
-    for (int i = 0; i < 7; i++)
-    {
-        auto* c = controls[i + 9];
-        if (i == 0)
-            c->setBounds (getGridArea (0, 1).removeFromTop (cy / 2).translated (0, 7));
-        else if (i == 1)
-            c->setBounds (getGridArea (0, 1).removeFromBottom (cy / 2));
-        else
-            c->setBounds (getGridArea (i - 1, 1));
-    }
-    for (int i = 0; i < 7; i++)
-    {
-        auto* c = controls[i + 9 + 7];
-        if (i == 0)
-            c->setBounds (getGridArea (0, 2).removeFromTop (cy / 2).translated (0, 7));
-        else if (i == 1)
-            c->setBounds (getGridArea (0, 2).removeFromBottom (cy / 2));
-        else
-            c->setBounds (getGridArea (i - 1, 2));
-    }
+        for (int i = first + 2; i <= last; i++)
+            controls[i]->setBounds (getGridArea (i - first - 1, row));
+    };
+    
+    layoutChannel (0, AP::idxPulse1OL, AP::idxPulse1Shift);
+    layoutChannel (1, AP::idxPulse2OL, AP::idxPulse2Fine);
+    layoutChannel (2, AP::idxNoiseOL, AP::idxNoiseRatio);
+    layoutChannel (3, AP::idxWaveOL, AP::idxWaveFine);
     
-    controls.getLast()->setBounds (getGridArea (7, 2));
+    controls[AP::idxOutput]->setBounds (getGridArea (7, 2));
+    controls[AP::idxVoices]->setBounds (getGridArea (7, 1));
+    controls[AP::idxQuality]->setBounds (getGridArea (6, 1));
+    controls[AP::idxTreble]->setBounds (getGridArea (8, 0));
+    controls[AP::idxCutoff]->setBounds (getGridArea (8, 1));
+    controls[AP::idxBass]->setBounds (getGridArea (8, 2));
     
-    scope.setBounds (getGridArea (8, 0, 5, 3).reduced (5));
+    scope.setBounds (getGridArea (9, 0, 5, 4).reduced (5));
 }
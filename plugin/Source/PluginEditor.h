@@ -16,7 +16,8 @@
 //==============================================================================
 /**
 */
-class PAPUAudioProcessorEditor  : public gin::GinAudioProcessorEditor
+class PAPUAudioProcessorEditor  : public gin::GinAudioProcessorEditor,
+                                  private Timer
 {
 public:
     PAPUAudioProcessorEditor (PAPUAudioProcessor&);
@@ -25,11 +26,15 @@ public:
     //==============================================================================
     void resized() override;
     void paint (Graphics& g) override;
+    void timerCallback() override;
 
     PAPUAudioProcessor& processor;
     
     drow::TriggeredScope scope;
     Image logo;
+
+private:
+    HeapBlock<float> scopeSamples { PAPUAudioProcessor::scopeRingSize };
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PAPUAudioProcessorEditor)
 };
@@ -40,6 +40,32 @@ const char* PAPUAudioProcessor::paramNoiseA           = "AN";
 const char* PAPUAudioProcessor::paramNoiseR           = "AR";
 
 const char* PAPUAudioProcessor::paramOutput           = "output";
+const char* PAPUAudioProcessor::paramVoices           = "voices";
+const char* PAPUAudioProcessor::paramQuality          = "quality";
+const char* PAPUAudioProcessor::paramTreble           = "treble";
+const char* PAPUAudioProcessor::paramCutoff           = "cutoff";
+const char* PAPUAudioProcessor::paramBass             = "bass";
+
+const char* PAPUAudioProcessor::paramWaveOL           = "OLW";
+const char* PAPUAudioProcessor::paramWaveOR           = "ORW";
+const char* PAPUAudioProcessor::paramWaveTable        = "tableW";
+const char* PAPUAudioProcessor::paramWaveLevel        = "levelW";
+const char* PAPUAudioProcessor::paramWaveTune         = "tuneW";
+const char* PAPUAudioProcessor::paramWaveFine         = "fineW";
+
+//==============================================================================
+// Wave RAM contents for each wave table, 32 4-bit samples packed high
+// nibble first
+static const int numWaveTables = 6;
+static const uint8_t waveTables[numWaveTables][Gb_Apu::wave_ram_size] =
+{
+    { 0x8a, 0xbc, 0xde, 0xff, 0xff, 0xed, 0xcb, 0xa8, 0x75, 0x43, 0x21, 0x00, 0x00, 0x12, 0x34, 0x57 }, // sine
+    { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10 }, // triangle
+    { 0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00 }, // saw
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // square
+    { 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 25% pulse
+    { 0x9c, 0xef, 0xfe, 0xdc, 0xba, 0xaa, 0xaa, 0x98, 0x76, 0x55, 0x55, 0x54, 0x32, 0x10, 0x01, 0x36 }, // organ, first three harmonics
+};
 
 //==============================================================================
 String percentTextFunction (const Parameter& p, float v)
@@ -101,6 +127,106 @@ String intTextFunction (const Parameter&, float v)
     return String (int (v));
 }
 
+String qualityTextFunction (const Parameter&, float v)
+{
+    switch (int (v))
+    {
+        case 0: return "Draft";
+        case 1: return "Normal";
+        case 2: return "High";
+        case 3: return "Ultra";
+    }
+    return "";
+}
+
+String waveTableTextFunction (const Parameter&, float v)
+{
+    switch (int (v))
+    {
+        case 0: return "Sine";
+        case 1: return "Triangle";
+        case 2: return "Saw";
+        case 3: return "Square";
+        case 4: return "Pulse";
+        case 5: return "Organ";
+    }
+    return "";
+}
+
+String waveLevelTextFunction (const Parameter&, float v)
+{
+    switch (int (v))
+    {
+        case 0: return "25%";
+        case 1: return "50%";
+        case 2: return "100%";
+    }
+    return "";
+}
+
+String dbTextFunction (const Parameter&, float v)
+{
+    return String::formatted("%.1f dB", v);
+}
+
+String hzTextFunction (const Parameter&, float v)
+{
+    return String::formatted("%d Hz", int (v));
+}
+
+String bassTextFunction (const Parameter& p, float v)
+{
+    return v > 0.0f ? hzTextFunction (p, v) : "Off";
+}
+
+//==============================================================================
+// one thread serves every instance, and it's idle until an EQ parameter moves
+struct PAPUEqWorker : public TimeSliceThread
+{
+    PAPUEqWorker() : TimeSliceThread ("PAPU EQ") { startThread(); }
+    ~PAPUEqWorker() override { stopThread (1000); }
+};
+
+class PAPUAudioProcessor::EqClient : public TimeSliceClient,
+                                     private Parameter::Listener
+{
+public:
+    EqClient (PAPUAudioProcessor& p) : processor (p)
+    {
+        for (int idx : { idxTreble, idxCutoff, idxBass })
+            processor.getPluginParameters()[idx]->addListener (this);
+    }
+
+    ~EqClient() override
+    {
+        for (int idx : { idxTreble, idxCutoff, idxBass })
+            processor.getPluginParameters()[idx]->removeListener (this);
+
+        worker->removeTimeSliceClient (this);
+    }
+
+    int useTimeSlice() override
+    {
+        // an offline render updates the EQ itself, in step with its blocks
+        if (! processor.isNonRealtime())
+            processor.updateEq();
+
+        return -1;
+    }
+
+private:
+    void parameterChanged (Parameter*) override
+    {
+        // removing waits out a call that's under way, so the next call is
+        // certain to see this change rather than being dropped after the last
+        worker->removeTimeSliceClient (this);
+        worker->addTimeSliceClient (this);
+    }
+
+    PAPUAudioProcessor& processor;
+    SharedResourcePointer<PAPUEqWorker> worker;
+};
+
 //==============================================================================
 PAPUAudioProcessor::PAPUAudioProcessor()
 {
@@ -131,197 +257,597 @@ PAPUAudioProcessor::PAPUAudioProcessor()
     addPluginParameter (new Parameter (paramNoiseRatio,      "Noise Ratio",        "Ratio",       "",   0.0f, 7.0f, 1.0f, 0.0f, 1.0f, intTextFunction));
     
     addPluginParameter (new Parameter (paramOutput,          "Output",             "Output",      "",   0.0f, 7.0f, 1.0f, 15.0f, 1.0f, percentTextFunction));
+    addPluginParameter (new Parameter (paramVoices,          "Voices",             "Voices",      "",   1.0f, float (maxVoices), 1.0f, 1.0f, 1.0f, intTextFunction));
+    addPluginParameter (new Parameter (paramQuality,         "Quality",            "Quality",     "",   0.0f, 3.0f, 1.0f, 1.0f, 1.0f, qualityTextFunction));
+    addPluginParameter (new Parameter (paramTreble,          "Treble",             "Treble",      "", -50.0f, 0.0f, 0.5f, -20.0f, 1.0f, dbTextFunction));
+    addPluginParameter (new Parameter (paramCutoff,          "Treble Cutoff",      "Cutoff",      "",   0.0f, 20000.0f, 10.0f, 0.0f, 0.3f, hzTextFunction));
+    addPluginParameter (new Parameter (paramBass,            "Bass",               "Bass",        "",   0.0f, 2000.0f, 1.0f, 461.0f, 0.3f, bassTextFunction));
+
+    addPluginParameter (new Parameter (paramWaveOL,          "Wave OL",            "Left",        "",   0.0f, 1.0f, 1.0f, 0.0f, 1.0f, enableTextFunction));
+    addPluginParameter (new Parameter (paramWaveOR,          "Wave OR",            "Right",       "",   0.0f, 1.0f, 1.0f, 0.0f, 1.0f, enableTextFunction));
+    addPluginParameter (new Parameter (paramWaveTable,       "Wave Table",         "Table",       "",   0.0f, float (numWaveTables - 1), 1.0f, 0.0f, 1.0f, waveTableTextFunction));
+    addPluginParameter (new Parameter (paramWaveLevel,       "Wave Level",         "Level",       "",   0.0f, 2.0f, 1.0f, 2.0f, 1.0f, waveLevelTextFunction));
+    addPluginParameter (new Parameter (paramWaveTune,        "Wave Tune",          "Tune",        "", -48.0f, 48.0f, 1.0f, 0.0f, 1.0f, intTextFunction));
+    addPluginParameter (new Parameter (paramWaveFine,        "Wave Tune Fine",     "Fine",        "", -100.0f, 100.0f, 1.0f, 0.0f, 1.0f, intTextFunction));
+
+    jassert (getPluginParameters().size() == numParams);
+
+    for (int i = 0; i < maxVoices; i++)
+        voices.add (new PAPUEngine (*this, bus));
+
+    noteQueue.ensureStorageAllocated (128);
+
+    eqClient = std::make_unique<EqClient> (*this);
 }
 
 PAPUAudioProcessor::~PAPUAudioProcessor()
 {
+    eqClient = nullptr;
 }
 
 //==============================================================================
-void PAPUAudioProcessor::prepareToPlay (double sampleRate, int /*samplesPerBlock*/)
+PAPUEngine::PAPUEngine (PAPUAudioProcessor& p, Gb_Apu_Bus& b)
+  : processor (p), bus (b)
 {
-    outputSmoothed.reset (sampleRate, 0.05);
+}
+
+void PAPUEngine::prepareToPlay()
+{
+    apu.reset();
+    regs.reset();
+    note = -1;
+    time = 0;
+
+    bus.attach (apu);
+
+    // power has to be on before anything else is written
+    writeReg (0xff26, 0x8f, true);
+    time = regs.flush (apu, time, 4);
+
+    idle = true;
+}
+
+void PAPUEngine::scheduleAt (int pos)
+{
+    if (! regs.pending())
+        return;
+
+    // samples already in the bus were rendered by an earlier frame, so
+    // anything aimed at them lands as early as the current frame allows
+    auto& buf = bus.buffer();
+    if (pos > buf.samples_avail())
+        time = jmax (time, buf.count_clocks (pos));
+
+    time = regs.flush (apu, time, 0);
+    idle = false;
+}
+
+blip_time_t PAPUEngine::addToFrame()
+{
+    bus.add_to_frame (apu);
+    return time;
+}
+
+void PAPUEngine::frameEnded()
+{
+    time = 0;
+
+    if (note == -1 && apu.silent())
+        idle = true;
+}
+
+void PAPUEngine::updateOutput (bool force)
+{
+    using AP = PAPUAudioProcessor;
+    auto& p = processor.getParameterSnapshot();
+
+    uint16_t reg;
+    
+    reg = uint16_t (0x08 | p.getIntValue (AP::idxOutput));
+    writeReg (0xff24, reg, force);
     
-    apu.treble_eq( -20.0 ); // lower values muffle it more
-    buf.bass_freq( 461 ); // higher values simulate smaller speaker
+    reg = (p.getIntValue (AP::idxPulse1OL) ? 0x10 : 0x00) |
+          (p.getIntValue (AP::idxPulse1OR) ? 0x01 : 0x00) |
+          (p.getIntValue (AP::idxPulse2OL) ? 0x20 : 0x00) |
+          (p.getIntValue (AP::idxPulse2OR) ? 0x02 : 0x00) |
+          (p.getIntValue (AP::idxWaveOL)   ? 0x40 : 0x00) |
+          (p.getIntValue (AP::idxWaveOR)   ? 0x04 : 0x00) |
+          (p.getIntValue (AP::idxNoiseOL)  ? 0x80 : 0x00) |
+          (p.getIntValue (AP::idxNoiseOR)  ? 0x08 : 0x00);
     
+    writeReg (0xff25, reg, force);
+}
+
+void PAPUEngine::runOscs (int curNote, bool trigger, double pitchBend)
+{
+    using AP = PAPUAudioProcessor;
+    auto& p = processor.getParameterSnapshot();
+
+    if (curNote != -1)
+    {
+        // Ch 1
+        uint8_t sweep = uint8_t (std::abs (p.getIntValue (AP::idxPulse1Sweep)));
+        uint8_t neg   = p.getIntValue (AP::idxPulse1Sweep) < 0;
+        uint8_t shift = uint8_t (p.getIntValue (AP::idxPulse1Shift));
+        
+        writeReg (0xff10, (sweep << 4) | ((neg ? 1 : 0) << 3) | shift, trigger);
+        writeReg (0xff11, (p.getIntValue (AP::idxPulse1Duty) << 6), trigger);
+        
+        float freq1 = float (getMidiNoteInHertz (curNote + pitchBend + p.getIntValue (AP::idxPulse1Tune) + p.getIntValue (AP::idxPulse1Fine) / 100.0f));
+        // periods are 11 bits, so notes out of range stop at the ends
+        uint16_t period1 = uint16_t (jlimit (0.0f, 2047.0f, ((4194304 / freq1) - 65536) / -32));
+        writeReg (0xff13, period1 & 0xff, trigger);
+        uint8_t a1 = uint8 (p.getIntValue (AP::idxPulse1A));
+        writeReg (0xff12, a1 ? (0x00 | (1 << 3) | a1) : 0xf0, trigger);
+        writeReg (0xff14, (trigger ? 0x80 : 0x00) | ((period1 >> 8) & 0x07), trigger);
+        
+        // Ch 2
+        writeReg (0xff16, (p.getIntValue (AP::idxPulse2Duty) << 6), trigger);
+        
+        float freq2 = float (getMidiNoteInHertz (curNote + pitchBend + p.getIntValue (AP::idxPulse2Tune) + p.getIntValue (AP::idxPulse2Fine) / 100.0f));
+        uint16_t period2 = uint16_t (jlimit (0.0f, 2047.0f, ((4194304 / freq2) - 65536) / -32));
+        writeReg (0xff18, period2 & 0xff, trigger);
+        uint8_t a2 = uint8_t (p.getIntValue (AP::idxPulse2A));
+        writeReg (0xff17, a2 ? (0x00 | (1 << 3) | a2) : 0xf0, trigger);
+        writeReg (0xff19, (trigger ? 0x80 : 0x00) | ((period2 >> 8) & 0x07), trigger);
+        
+        // Ch 3. The table is only written when it changes, and then goes to
+        // the APU in one piece rather than as 16 separate writes. The DAC
+        // stays off unless the channel is panned somewhere, as an enabled
+        // channel changes how the APU reacts to the output level.
+        auto table = waveTables[jlimit (0, numWaveTables - 1, p.getIntValue (AP::idxWaveTable))];
+        for (int i = 0; i < Gb_Apu::wave_ram_size; i++)
+            writeReg (Gb_Apu::wave_ram_addr + i, table[i], false);
+        
+        const bool waveOn = p.getIntValue (AP::idxWaveOL) || p.getIntValue (AP::idxWaveOR);
+        writeReg (0xff1a, waveOn ? 0x80 : 0x00, trigger);
+        writeReg (0xff1c, (3 - p.getIntValue (AP::idxWaveLevel)) << 5, trigger);
+        
+        float freq3 = float (getMidiNoteInHertz (curNote + pitchBend + p.getIntValue (AP::idxWaveTune) + p.getIntValue (AP::idxWaveFine) / 100.0f));
+        uint16_t period3 = uint16_t (jlimit (0.0f, 2047.0f, ((4194304 / freq3) - 131072) / -64));
+        writeReg (0xff1d, period3 & 0xff, trigger);
+        writeReg (0xff1e, (trigger ? 0x80 : 0x00) | ((period3 >> 8) & 0x07), trigger);
+        
+        // Noise
+        uint8_t aN = uint8_t (p.getIntValue (AP::idxNoiseA));
+        writeReg (0xff21, aN ? (0x00 | (1 << 3) | aN) : 0xf0, trigger);
+        writeReg (0xff22, (p.getIntValue (AP::idxNoiseShift) << 4) |
+                            (p.getIntValue (AP::idxNoiseStep)  << 3) |
+                            (p.getIntValue (AP::idxNoiseRatio)), trigger);
+        writeReg (0xff23, trigger ? 0x80 : 0x00, trigger);
+    }
+    else
+    {
+        uint8_t r1 = uint8_t (p.getIntValue (AP::idxPulse1R));
+        writeReg (0xff12, r1 ? (0xf0 | (0 << 3) | r1) : 0, trigger);
+        
+        uint8_t r2 = uint8_t (p.getIntValue (AP::idxPulse2R));
+        writeReg (0xff17, r2 ? (0xf0 | (0 << 3) | r2) : 0, trigger);
+        
+        // the wave channel has no envelope, so it stops right away
+        writeReg (0xff1a, 0x00, trigger);
+        
+        uint8_t rN = uint8_t (p.getIntValue (AP::idxNoiseR));
+        writeReg (0xff21, rN ? (0xf0 | (0 << 3) | rN) : 0, trigger);
+    }
+}
+
+void PAPUEngine::writeReg (int reg, int value, bool force)
+{
+    regs.write (gb_addr_t (reg), value, force);
+}
+
+//==============================================================================
+void PAPUAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    outputSmoothed.reset (sampleRate, 0.05);
+
+    // the bus never holds more than a block plus the fraction of a sample the
+    // last frame ran past it, so it's sized from the block size rather than
+    // Blip_Buffer's default of about 65000 samples. A millisecond is added for
+    // the power-on writes, and bigger blocks are rendered in pieces.
+    maxBusSamples = jmax (1, samplesPerBlock);
+    const int msec = int (std::ceil (maxBusSamples * 1000.0 / sampleRate)) + 1;
+
+    auto& buf = bus.buffer();
     buf.clock_rate (4194304);
-    buf.set_sample_rate (long (sampleRate));
+    buf.set_sample_rate (long (sampleRate), msec);
 
-    apu.output (buf.center(), buf.left(), buf.right());
+    {
+        // nothing is playing, so the EQ is set up here directly
+        const ScopedLock sl (eqLock);
 
-    writeReg (0xff26, 0x8f, true);
+        eqSampleRate = sampleRate;
+        eqTreble = parameterValue (idxTreble);
+        eqCutoff = parameterValue (idxCutoff);
+        eqBass = parameterIntValue (idxBass);
+
+        const blip_eq_t eq = getTrebleEq();
+        for (auto v : voices)
+            v->setTrebleEq (eq);
+
+        bassSetting = eqBass << 5 | Blip_Buffer::bass_shift_for (long (sampleRate), eqBass);
+        busBass = -1;
+        applyBass();
+    }
+
+    reset();
+}
+
+blip_eq_t PAPUAudioProcessor::getTrebleEq() const
+{
+    // lower treble muffles it more. The treble level is for the output's
+    // Nyquist frequency at any sample rate, as it's always been, while the
+    // cutoff is scaled so that it's in Hz at the real rate.
+    return blip_eq_t (eqTreble, long (eqCutoff * 44100 / eqSampleRate), 44100);
+}
+
+void PAPUAudioProcessor::updateEq()
+{
+    const ScopedLock sl (eqLock);
+
+    const float treble = parameterValue (idxTreble);
+    const float cutoff = parameterValue (idxCutoff);
+    if (treble != eqTreble || cutoff != eqCutoff)
+    {
+        eqTreble = treble;
+        eqCutoff = cutoff;
+
+        const blip_eq_t eq = getTrebleEq();
+        for (auto v : voices)
+            v->prepareTrebleEq (eq);
+    }
+
+    // higher bass frequencies simulate a smaller speaker
+    const int bass = parameterIntValue (idxBass);
+    if (bass != eqBass)
+    {
+        eqBass = bass;
+        bassSetting = bass << 5 | Blip_Buffer::bass_shift_for (long (eqSampleRate), bass);
+    }
+}
+
+void PAPUAudioProcessor::applyBass()
+{
+    const int bass = bassSetting.load (std::memory_order_relaxed);
+    if (bass != busBass)
+    {
+        busBass = bass;
+        bus.buffer().bass_freq (bass >> 5, bass & 31);
+    }
+}
+
+void PAPUAudioProcessor::reset()
+{
+    noteQueue.clearQuick();
+    lastNote = -1;
+    pitchBend = 0;
+    
+    for (auto v : voices)
+        v->prepareToPlay();
+
+    // everything past the unread samples is already silent
+    bus.buffer().clear (false);
+    busIdle = false; // the power-on writes are run with the first frame
 }
 
 void PAPUAudioProcessor::releaseResources()
 {
 }
 
-void PAPUAudioProcessor::runUntil (int& done, AudioSampleBuffer& buffer, int pos)
+void PAPUAudioProcessor::scheduleAt (int pos)
 {
-    int todo = jmin (pos, buffer.getNumSamples()) - done;
+    for (auto v : voices)
+        v->scheduleAt (pos);
+}
 
-    while (todo > 0)
+PAPUEngine* PAPUAudioProcessor::findVoice()
+{
+    const int numVoices = getParameterSnapshot().getIntValue (idxVoices);
+
+    // Prefer a voice that has finished its release, then the voice that was
+    // released longest ago, and finally steal the oldest held note.
+    PAPUEngine* idle = nullptr;
+    PAPUEngine* released = nullptr;
+    PAPUEngine* held = nullptr;
+
+    for (int i = 0; i < numVoices; i++)
     {
-        if (buf.samples_avail() > 0)
+        auto v = voices[i];
+
+        if (v->isIdle())
         {
-            blip_sample_t out[1024];
-            
-            int count = int (buf.read_samples (out, jmin (todo, 1024 / 2, (int) buf.samples_avail())));
-        
-            float* data0 = buffer.getWritePointer (0, done);
-            float* data1 = buffer.getWritePointer (1, done);
-            
-            for (int i = 0; i < count; i++)
-            {
-                data0[i] = out[i * 2 + 0] / 32768.0f;
-                data1[i] = out[i * 2 + 1] / 32768.0f;
-            }
-            
-            done += count;
-            todo -= count;
+            if (idle == nullptr || v->age < idle->age)
+                idle = v;
+        }
+        else if (v->note == -1)
+        {
+            if (released == nullptr || v->age < released->age)
+                released = v;
         }
         else
         {
-            time = 0;
+            if (held == nullptr || v->age < held->age)
+                held = v;
+        }
+    }
+
+    if (idle != nullptr)     return idle;
+    if (released != nullptr) return released;
+    return held;
+}
+
+void PAPUAudioProcessor::noteOn (int note)
+{
+    if (auto v = findVoice())
+    {
+        v->note = note;
+        v->age  = nextAge++;
+        v->updateOutput (false);
+        v->runOscs (note, true, pitchBend);
+    }
+}
 
-            bool stereo = apu.end_frame (1024);
-            buf.end_frame (1024, stereo);
+void PAPUAudioProcessor::noteOff (int note)
+{
+    for (auto v : voices)
+    {
+        if (v->note == note)
+        {
+            v->note = -1;
+            v->age  = nextAge++;
+            v->runOscs (-1, false, pitchBend);
+            break;
         }
     }
 }
 
+void PAPUAudioProcessor::allNotesOff()
+{
+    for (auto v : voices)
+    {
+        if (v->note != -1)
+        {
+            v->note = -1;
+            v->age  = nextAge++;
+            v->runOscs (-1, false, pitchBend);
+        }
+    }
+}
+
+bool PAPUAudioProcessor::allVoicesIdle() const
+{
+    for (auto v : voices)
+        if (! v->isIdle())
+            return false;
+
+    return true;
+}
+
 void PAPUAudioProcessor::processBlock (AudioSampleBuffer& buffer, MidiBuffer& midi)
 {
-    uint16_t reg;
-    
-    reg = uint16_t (0x08 | parameterIntValue (paramOutput));
-    writeReg (0xff24, reg, false);
-    
-    reg = (parameterIntValue (paramPulse1OL) ? 0x10 : 0x00) |
-          (parameterIntValue (paramPulse1OR) ? 0x01 : 0x00) |
-          (parameterIntValue (paramPulse2OL) ? 0x20 : 0x00) |
-          (parameterIntValue (paramPulse2OR) ? 0x02 : 0x00) |
-          (parameterIntValue (paramNoiseOL)  ? 0x80 : 0x00) |
-          (parameterIntValue (paramNoiseOR)  ? 0x08 : 0x00);
-    
-    writeReg (0xff25, reg, false);
-    
-    int done = 0;
-    runOscs (lastNote, false);
-    runUntil (done, buffer, 0);
+    const int numVoices = updateParameterSnapshot().getIntValue (idxVoices);
+
+    if (isNonRealtime())
+        updateEq();
+
+    applyBass();
+
+    buffer.clear();
+
+    // with nothing sounding and no new events there is nothing to emulate
+    if (! midi.isEmpty() || ! busIdle)
+        renderVoices (buffer, midi, numVoices);
+
+    if (scopeAttached.load (std::memory_order_acquire))
+        writeScopeSamples (buffer);
+}
+
+void PAPUAudioProcessor::writeScopeSamples (const AudioSampleBuffer& buffer)
+{
+    const float* dataL = buffer.getReadPointer (0);
+    const float* dataR = buffer.getReadPointer (1);
+
+    // if the editor falls behind the rest of the block is dropped, the scope
+    // only ever shows the most recent audio anyway
+    int start1, size1, start2, size2;
+    scopeFifo.prepareToWrite (buffer.getNumSamples(), start1, size1, start2, size2);
+
+    for (int i = 0; i < size1; i++)
+        scopeRing[start1 + i] = (dataL[i] + dataR[i]) / 2.0f;
+
+    for (int i = 0; i < size2; i++)
+        scopeRing[start2 + i] = (dataL[size1 + i] + dataR[size1 + i]) / 2.0f;
+
+    scopeFifo.finishedWrite (size1 + size2);
+}
+
+void PAPUAudioProcessor::setScopeAttached (bool attached)
+{
+    // samples left over from a previous editor are stale, the reading side
+    // may discard them without racing the audio thread
+    if (attached)
+        scopeFifo.finishedRead (scopeFifo.getNumReady());
+
+    scopeAttached.store (attached, std::memory_order_release);
+}
+
+int PAPUAudioProcessor::readScopeSamples (float* dest, int maxSamples)
+{
+    int start1, size1, start2, size2;
+    scopeFifo.prepareToRead (maxSamples, start1, size1, start2, size2);
+
+    if (size1 > 0) FloatVectorOperations::copy (dest, scopeRing + start1, size1);
+    if (size2 > 0) FloatVectorOperations::copy (dest + size1, scopeRing + start2, size2);
+
+    scopeFifo.finishedRead (size1 + size2);
+    return size1 + size2;
+}
+
+void PAPUAudioProcessor::renderVoices (AudioSampleBuffer& buffer, MidiBuffer& midi, int numVoices)
+{
+    const bool singleVoice = numVoices <= 1;
+
+    if (singleVoice != monoMode)
+    {
+        allNotesOff();
+        noteQueue.clear();
+        lastNote = -1;
+        monoMode = singleVoice;
+    }
+
+    // voices beyond the current voice count are left to finish their release
+    for (int i = numVoices; i < voices.size(); i++)
+    {
+        if (voices[i]->note != -1)
+        {
+            voices[i]->note = -1;
+            voices[i]->runOscs (-1, false, pitchBend);
+        }
+    }
+
+    // voices take a quality change from this block on, without a click
+    const int quality = getParameterSnapshot().getIntValue (idxQuality);
+    for (auto v : voices)
+        v->setQuality (quality);
+
+    for (auto v : voices)
+    {
+        if (! v->isIdle())
+        {
+            v->updateOutput (false);
+            v->runOscs (v->note, false, pitchBend);
+        }
+    }
+
+    scheduleAt (0);
     
-    int pos = 0;
+    float* left = buffer.getWritePointer (0);
+    float* right = buffer.getWritePointer (1);
+
+    // events are written to the APUs at their own clock time, so the whole
+    // block can be rendered in one pass afterwards. Only a block bigger than
+    // the bus holds has to be rendered up to an event before it's handled.
+    int pos = 0, rendered = 0;
     MidiMessage msg;
     MidiBuffer::Iterator itr (midi);
     while (itr.getNextEvent (msg, pos))
     {
+        if (pos - rendered > maxBusSamples)
+        {
+            renderBus (left + rendered, right + rendered, pos - rendered);
+            rendered = pos;
+        }
+
         bool updateBend = false;
-        runUntil (done, buffer, pos);
         
         if (msg.isNoteOn())
         {
-            noteQueue.add (msg.getNoteNumber());
             velocity = msg.getVelocity();
+
+            if (singleVoice)
+                noteQueue.add (msg.getNoteNumber());
+            else
+                noteOn (msg.getNoteNumber());
         }
         else if (msg.isNoteOff())
         {
-            noteQueue.removeFirstMatchingValue (msg.getNoteNumber());
+            if (singleVoice)
+                noteQueue.removeFirstMatchingValue (msg.getNoteNumber());
+            else
+                noteOff (msg.getNoteNumber());
         }
         else if (msg.isAllNotesOff())
         {
-            noteQueue.clear();
+            if (singleVoice)
+                noteQueue.clear();
+            else
+                allNotesOff();
         }
         else if (msg.isPitchWheel())
         {
             updateBend = true;
             pitchBend = (msg.getPitchWheelValue() - 8192) / 8192.0f * 2;
         }
-        const int curNote = noteQueue.size() > 0 ? noteQueue.getLast() : -1;
-        
-        if (updateBend || lastNote != curNote)
+
+        if (singleVoice)
+        {
+            const int curNote = noteQueue.size() > 0 ? noteQueue.getLast() : -1;
+            
+            if (updateBend || lastNote != curNote)
+            {
+                voices[0]->note = curNote;
+                voices[0]->updateOutput (false);
+                voices[0]->runOscs (curNote, lastNote != curNote, pitchBend);
+                lastNote = curNote;
+            }
+        }
+        else if (updateBend)
         {
-            runOscs (curNote, lastNote != curNote);
-            lastNote = curNote;
+            for (auto v : voices)
+                if (v->note != -1)
+                    v->runOscs (v->note, false, pitchBend);
         }
+
+        scheduleAt (pos - rendered);
     }
     
-    runUntil (done, buffer, buffer.getNumSamples());
-    
-    float* dataL = buffer.getWritePointer (0);
-    float* dataR = buffer.getWritePointer (1);
-    
-    ScopedLock sl (editorLock);
-    if (editor)
-    {
-        float* mono = (float*) alloca (buffer.getNumSamples() * sizeof (float));
-        
-        for (int i = 0; i < buffer.getNumSamples(); i++)
-            mono[i] = (dataL[i] + dataR[i]) / 2.0f;
-        
-        editor->scope.addSamples (mono, buffer.getNumSamples());
-    }
+    renderBus (left + rendered, right + rendered, buffer.getNumSamples() - rendered);
 }
 
-void PAPUAudioProcessor::runOscs (int curNote, bool trigger)
+void PAPUAudioProcessor::renderBus (float* left, float* right, int numSamples)
 {
-    if (curNote != -1)
+    while (numSamples > maxBusSamples)
     {
-        // Ch 1
-        uint8_t sweep = uint8_t (std::abs (parameterIntValue (paramPulse1Sweep)));
-        uint8_t neg   = parameterIntValue (paramPulse1Sweep) < 0;
-        uint8_t shift = uint8_t (parameterIntValue (paramPulse1Shift));
-        
-        writeReg (0xff10, (sweep << 4) | ((neg ? 1 : 0) << 3) | shift, trigger);
-        writeReg (0xff11, (parameterIntValue (paramPulse1Duty) << 6), trigger);
-        
-        float freq1 = float (getMidiNoteInHertz (curNote + pitchBend + parameterIntValue (paramPulse1Tune) + parameterIntValue (paramPulse1Fine) / 100.0f));
-        uint16_t period1 = uint16_t (((4194304 / freq1) - 65536) / -32);
-        writeReg (0xff13, period1 & 0xff, trigger);
-        uint8_t a1 = uint8 (parameterIntValue (paramPulse1A));
-        writeReg (0xff12, a1 ? (0x00 | (1 << 3) | a1) : 0xf0, trigger);
-        writeReg (0xff14, (trigger ? 0x80 : 0x00) | ((period1 >> 8) & 0x07), trigger);
-        
-        // Ch 2
-        writeReg (0xff16, (parameterIntValue (paramPulse2Duty) << 6), trigger);
-        
-        float freq2 = float (getMidiNoteInHertz (curNote + pitchBend + parameterIntValue (paramPulse2Tune) + parameterIntValue (paramPulse2Fine) / 100.0f));
-        uint16_t period2 = uint16_t (((4194304 / freq2) - 65536) / -32);
-        writeReg (0xff18, period2 & 0xff, trigger);
-        uint8_t a2 = uint8_t (parameterIntValue (paramPulse2A));
-        writeReg (0xff17, a2 ? (0x00 | (1 << 3) | a2) : 0xf0, trigger);
-        writeReg (0xff19, (trigger ? 0x80 : 0x00) | ((period2 >> 8) & 0x07), trigger);
-        
-        // Noise
-        uint8_t aN = uint8_t (parameterIntValue (paramNoiseA));
-        writeReg (0xff21, aN ? (0x00 | (1 << 3) | aN) : 0xf0, trigger);
-        writeReg (0xff22, (parameterIntValue (paramNoiseShift) << 4) |
-                            (parameterIntValue (paramNoiseStep)  << 3) |
-                            (parameterIntValue (paramNoiseRatio)), trigger);
-        writeReg (0xff23, trigger ? 0x80 : 0x00, trigger);
-    }
-    else
-    {
-        uint8_t r1 = uint8_t (parameterIntValue (paramPulse1R));
-        writeReg (0xff12, r1 ? (0xf0 | (0 << 3) | r1) : 0, trigger);
-        
-        uint8_t r2 = uint8_t (parameterIntValue (paramPulse2R));
-        writeReg (0xff17, r2 ? (0xf0 | (0 << 3) | r2) : 0, trigger);
-        
-        uint8_t rN = uint8_t (parameterIntValue (paramNoiseR));
-        writeReg (0xff21, rN ? (0xf0 | (0 << 3) | rN) : 0, trigger);
+        renderFrame (left, right, maxBusSamples);
+        left += maxBusSamples;
+        right += maxBusSamples;
+        numSamples -= maxBusSamples;
     }
+
+    renderFrame (left, right, numSamples);
 }
 
-void PAPUAudioProcessor::writeReg (int reg, int value, bool force)
+void PAPUAudioProcessor::renderFrame (float* left, float* right, int numSamples)
 {
-    auto itr = regCache.find (reg);
-    if (force || itr == regCache.end() || itr->second != value)
+    scheduleAt (0);
+
+    auto& buf = bus.buffer();
+
+    if (buf.samples_avail() < numSamples)
     {
-        regCache[reg] = value;
-        apu.write_register (clock(), reg, value);
+        blip_time_t clocks = buf.count_clocks (numSamples);
+
+        // all voices share one frame, which can't end before the last
+        // register write of any of them
+        for (auto v : voices)
+            if (v->inFrame())
+                clocks = jmax (clocks, v->addToFrame());
+
+        bus.end_frame (clocks);
+
+        for (auto v : voices)
+            if (v->inFrame())
+                v->frameEnded();
     }
+
+    int count = int (buf.add_samples (left, right, numSamples));
+    jassert (count == numSamples);
+    ignoreUnused (count);
+
+    // wide buffers don't clamp, so a loud pool is held to full scale here,
+    // where 16-bit buffers would have clamped it
+    FloatVectorOperations::clip (left, left, -1.0f, 1.0f, numSamples);
+    FloatVectorOperations::clip (right, right, -1.0f, 1.0f, numSamples);
+
+    // once every voice is idle and their tails have faded out, anything still
+    // buffered is silence, so it can be dropped along with the filter state
+    busIdle = allVoicesIdle() && buf.settled();
+
+    if (busIdle)
+        buf.clear (false);
 }
+
 //==============================================================================
 bool PAPUAudioProcessor::hasEditor() const
 {
@@ -330,8 +856,7 @@ bool PAPUAudioProcessor::hasEditor() const
 
 AudioProcessorEditor* PAPUAudioProcessor::createEditor()
 {
-    editor = new PAPUAudioProcessorEditor (*this);
-    return editor;
+    return new PAPUAudioProcessorEditor (*this);
 }
 
 //==============================================================================
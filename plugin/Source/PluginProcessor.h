@@ -12,7 +12,72 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "gb_apu/Gb_Apu.h"
-#include "gb_apu/Multi_Buffer.h"
+#include "gb_apu/Gb_Apu_Bus.h"
+#include "gb_apu/Gb_Shadow_Regs.h"
+
+class PAPUAudioProcessor;
+
+//==============================================================================
+/** One Game Boy APU and its registers. The processor owns a fixed pool of
+    these so that note-on never has to allocate, and they all mix into the
+    processor's shared bus.
+*/
+class PAPUEngine
+{
+public:
+    PAPUEngine (PAPUAudioProcessor& processor, Gb_Apu_Bus& bus);
+
+    void prepareToPlay();
+
+    /** Writes any register changes made since the last call to the APU at the
+        clock time of sample pos in the block that will be rendered next. */
+    void scheduleAt (int pos);
+
+    /** Adds the APU to the bus's current frame and returns the earliest
+        time the frame can end, after its last register write. */
+    blip_time_t addToFrame();
+
+    /** Called once the bus has ended the frame the APU was added to. */
+    void frameEnded();
+
+    void runOscs (int curNote, bool trigger, double pitchBend);
+    void updateOutput (bool force);
+    void setQuality (int quality) { apu.quality (quality); }
+
+    /** setTrebleEq() regenerates the impulses right away, so it's only for
+        when the voice isn't playing. prepareTrebleEq() can be called while
+        the audio thread runs the voice, which switches to the new impulses
+        at the end of its next frame. */
+    void setTrebleEq (const blip_eq_t& eq)      { apu.treble_eq (eq); }
+    void prepareTrebleEq (const blip_eq_t& eq)  { apu.prepare_treble_eq (eq); }
+
+    /** True once the voice has no note and every oscillator is silent. An
+        idle voice isn't run until it gets a note or a register write; what
+        it already added to the bus fades out there. */
+    bool isIdle() const { return note == -1 && idle; }
+
+    /** True if the APU has to be run in the bus's current frame, because it
+        is sounding or has been written to. */
+    bool inFrame() const { return ! isIdle() || time > 0; }
+
+    int note = -1;
+    uint32 age = 0;
+
+private:
+    PAPUAudioProcessor& processor;
+
+    Gb_Apu_Bus& bus;
+    Gb_Apu apu;
+
+    blip_time_t time = 0;
+    bool idle = true;
+
+    void writeReg (int reg, int value, bool force);
+
+    Gb_Shadow_Regs regs;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PAPUEngine)
+};
 
 //==============================================================================
 /**
@@ -28,6 +93,7 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void reset() override;
 
     void processBlock (AudioSampleBuffer&, MidiBuffer&) override;
 
@@ -64,36 +130,93 @@ public:
     static const char* paramNoiseR;
     
     static const char* paramOutput;
+    static const char* paramVoices;
+    static const char* paramQuality;
+    static const char* paramTreble;
+    static const char* paramCutoff;
+    static const char* paramBass;
 
-    void setEditor (PAPUAudioProcessorEditor* editor_)
+    static const char* paramWaveOL;
+    static const char* paramWaveOR;
+    static const char* paramWaveTable;
+    static const char* paramWaveLevel;
+    static const char* paramWaveTune;
+    static const char* paramWaveFine;
+
+    /** Parameter indices, in the order the parameters are added. The audio
+        thread reads values by index from the parameter snapshot. */
+    enum ParamIndex
     {
-        ScopedLock sl (editorLock);
-        editor = editor_;
-    }
-    
+        idxPulse1OL, idxPulse1OR, idxPulse1Duty, idxPulse1A, idxPulse1R, idxPulse1Tune, idxPulse1Fine, idxPulse1Sweep, idxPulse1Shift,
+        idxPulse2OL, idxPulse2OR, idxPulse2Duty, idxPulse2A, idxPulse2R, idxPulse2Tune, idxPulse2Fine,
+        idxNoiseOL, idxNoiseOR, idxNoiseA, idxNoiseR, idxNoiseShift, idxNoiseStep, idxNoiseRatio,
+        idxOutput, idxVoices, idxQuality, idxTreble, idxCutoff, idxBass,
+        idxWaveOL, idxWaveOR, idxWaveTable, idxWaveLevel, idxWaveTune, idxWaveFine,
+        numParams
+    };
+
+    enum { maxVoices = 16 };
+
+    /** The editor's scope is fed through a single-producer, single-consumer
+        ring: while a scope is attached the audio thread writes a mono downmix
+        of each block into it, without locking or allocating, and the message
+        thread drains it with readScopeSamples(). */
+    void setScopeAttached (bool attached);
+
+    /** Reads up to maxSamples pending scope samples, returns how many were
+        read. Call from the message thread only. */
+    int readScopeSamples (float* dest, int maxSamples);
+
+    enum { scopeRingSize = 32768 };
+
 private:
-    void runUntil (int& done, AudioSampleBuffer& buffer, int pos);
-    void runOscs (int curNote, bool trigger);
-    
+    void renderVoices (AudioSampleBuffer&, MidiBuffer&, int numVoices);
+    void renderBus (float* left, float* right, int numSamples);
+    void renderFrame (float* left, float* right, int numSamples);
+    void writeScopeSamples (const AudioSampleBuffer&);
+    void scheduleAt (int pos);
+    bool allVoicesIdle() const;
+
+    /** Treble impulses take hundreds of cos() and pow() calls to generate and
+        the bass filter's shift needs a log(), so neither is worked out on the
+        audio thread. A worker shared by every instance prepares both when
+        the treble, cutoff or bass parameters change; the voices switch to
+        new impulses at their next frame boundary and the bus picks up the
+        new shift at the start of the next block. */
+    class EqClient;
+    void updateEq();
+    blip_eq_t getTrebleEq() const;
+    void applyBass();
+
+    void noteOn (int note);
+    void noteOff (int note);
+    void allNotesOff();
+    PAPUEngine* findVoice();
+
     int lastNote = -1, velocity = 0;
     double pitchBend = 0;
     Array<int> noteQueue;
     
     LinearSmoothedValue<float> outputSmoothed;
-    CriticalSection editorLock;
-    PAPUAudioProcessorEditor* editor = nullptr;
-    
-    Gb_Apu apu;
-    Stereo_Buffer buf;
-    
-    blip_time_t time = 0;
+    std::atomic<bool> scopeAttached { false };
+    AbstractFifo scopeFifo { scopeRingSize };
+    HeapBlock<float> scopeRing { scopeRingSize, true };
     
-    blip_time_t clock() { return time += 4; }
-    
-    void writeReg (int reg, int value, bool force);
-    
-    std::map<int, int> regCache;
-        
+    Gb_Apu_Bus bus;
+    int maxBusSamples = 1;
+    bool busIdle = true;
+    OwnedArray<PAPUEngine> voices;
+    uint32 nextAge = 0;
+    bool monoMode = true;
+
+    CriticalSection eqLock; // between prepareToPlay() and the EQ worker
+    double eqSampleRate = 44100.0;
+    float eqTreble = 0.0f, eqCutoff = 0.0f;
+    int eqBass = -1;
+    std::atomic<int> bassSetting { 0 }; // frequency << 5 | shift
+    int busBass = -1;
+    std::unique_ptr<EqClient> eqClient;
+
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PAPUAudioProcessor)
 };
@@ -0,0 +1,317 @@
+/*
+  ==============================================================================
+
+    papu-render: renders MIDI files through PAPU with a preset, offline and
+    as fast as the CPU allows. No editor, audio device or message loop is
+    used; each worker thread owns its own PAPUAudioProcessor.
+
+      papu-render [options] preset.xml input.mid output.wav
+      papu-render [options] --jobs=list.txt
+
+    A job list has one job per line: preset, MIDI file and output file,
+    separated by spaces (quote paths that contain spaces). Relative paths
+    are resolved against the folder of the job list, and lines starting
+    with # are ignored. The output format is picked from the extension,
+    .wav or .flac.
+
+  ==============================================================================
+*/
+
+#include "../plugin/Source/PluginProcessor.h"
+
+#include <iostream>
+
+namespace
+{
+    struct RenderOptions
+    {
+        double sampleRate = 44100.0;
+        int bitsPerSample = 16;
+        int blockSize     = 512;
+        double tail       = 1.0;
+    };
+
+    struct RenderJob
+    {
+        File preset, midi, output;
+    };
+
+    CriticalSection logLock;
+
+    void log (const String& text)
+    {
+        ScopedLock sl (logLock);
+        std::cout << text << std::endl;
+    }
+
+    std::unique_ptr<AudioFormat> createFormatFor (const File& f)
+    {
+        if (f.hasFileExtension ("wav"))  return std::make_unique<WavAudioFormat>();
+        if (f.hasFileExtension ("flac")) return std::make_unique<FlacAudioFormat>();
+        return {};
+    }
+
+    //==============================================================================
+    /** Renders one job, returns the number of samples written or an error. */
+    Result render (PAPUAudioProcessor& proc, const RenderJob& job, const RenderOptions& opts, int64& samplesWritten)
+    {
+        gin::GinProgram program;
+        program.loadFromFile (job.preset);
+
+        if (program.states.isEmpty())
+            return Result::fail ("Can't read preset " + job.preset.getFullPathName());
+
+        MidiFile midiFile;
+        FileInputStream midiStream (job.midi);
+
+        if (! midiStream.openedOk() || ! midiFile.readFrom (midiStream))
+            return Result::fail ("Can't read MIDI file " + job.midi.getFullPathName());
+
+        midiFile.convertTimestampTicksToSeconds();
+
+        MidiMessageSequence events;
+        for (int i = 0; i < midiFile.getNumTracks(); i++)
+            events.addSequence (*midiFile.getTrack (i), 0);
+
+        auto format = createFormatFor (job.output);
+        if (format == nullptr)
+            return Result::fail ("Unknown output format " + job.output.getFileName());
+
+        job.output.deleteFile();
+        job.output.getParentDirectory().createDirectory();
+
+        std::unique_ptr<OutputStream> outStream (job.output.createOutputStream());
+        if (outStream == nullptr)
+            return Result::fail ("Can't write " + job.output.getFullPathName());
+
+        std::unique_ptr<AudioFormatWriter> writer (format->createWriterFor (outStream.get(), opts.sampleRate, 2,
+                                                                            opts.bitsPerSample, {}, 0));
+        if (writer == nullptr)
+            return Result::fail ("Can't write " + job.output.getFullPathName() + " at this sample rate and bit depth");
+
+        outStream.release(); // now owned by the writer
+
+        // nothing would ever deliver host notifications here
+        program.loadProcessor (&proc, false);
+
+        proc.setNonRealtime (true);
+        proc.setRateAndBufferSizeDetails (opts.sampleRate, opts.blockSize);
+        proc.prepareToPlay (opts.sampleRate, opts.blockSize);
+
+        const int64 totalSamples = int64 (std::ceil ((events.getEndTime() + opts.tail) * opts.sampleRate));
+
+        AudioSampleBuffer buffer (2, opts.blockSize);
+        MidiBuffer midi;
+        int nextEvent = 0;
+
+        for (int64 pos = 0; pos < totalSamples;)
+        {
+            const int numSamples = int (jmin (int64 (opts.blockSize), totalSamples - pos));
+            buffer.setSize (2, numSamples, false, false, true);
+
+            midi.clear();
+            while (nextEvent < events.getNumEvents())
+            {
+                auto& msg = events.getEventPointer (nextEvent)->message;
+                const int64 samplePos = roundToInt (msg.getTimeStamp() * opts.sampleRate);
+
+                if (samplePos >= pos + numSamples)
+                    break;
+
+                if (! msg.isMetaEvent())
+                    midi.addEvent (msg, int (jmax (int64 (0), samplePos - pos)));
+
+                nextEvent++;
+            }
+
+            proc.processBlock (buffer, midi);
+
+            if (! writer->writeFromAudioSampleBuffer (buffer, 0, numSamples))
+                return Result::fail ("Error writing " + job.output.getFullPathName());
+
+            pos += numSamples;
+        }
+
+        proc.releaseResources();
+
+        samplesWritten = totalSamples;
+        return Result::ok();
+    }
+
+    //==============================================================================
+    /** The jobs shared by all workers, handed out in order. */
+    class JobQueue
+    {
+    public:
+        JobQueue (const Array<RenderJob>& jobs_, const RenderOptions& opts_)
+          : jobs (jobs_), opts (opts_)
+        {
+        }
+
+        const RenderJob* next()
+        {
+            const int idx = nextJob++;
+            return idx < jobs.size() ? &jobs.getReference (idx) : nullptr;
+        }
+
+        const Array<RenderJob>& jobs;
+        const RenderOptions& opts;
+
+        std::atomic<int> nextJob { 0 }, numFailed { 0 };
+        std::atomic<int64> samplesRendered { 0 };
+    };
+
+    /** A worker thread with its own processor. The processor is created on
+        the thread that constructs the worker, since GinProcessor touches
+        global state when it is created and destroyed. */
+    class RenderThread : public Thread
+    {
+    public:
+        RenderThread (JobQueue& q)
+          : Thread ("papu-render"), queue (q)
+        {
+        }
+
+        void run() override
+        {
+            while (auto job = queue.next())
+            {
+                int64 samples = 0;
+                auto result = render (processor, *job, queue.opts, samples);
+
+                if (result.wasOk())
+                {
+                    queue.samplesRendered += samples;
+                    log ("Rendered " + job->output.getFullPathName());
+                }
+                else
+                {
+                    queue.numFailed++;
+                    log ("Failed: " + result.getErrorMessage());
+                }
+            }
+        }
+
+    private:
+        JobQueue& queue;
+        PAPUAudioProcessor processor;
+    };
+
+    //==============================================================================
+    File resolve (const File& base, const String& path)
+    {
+        return base.getChildFile (path.unquoted());
+    }
+
+    Array<RenderJob> readJobList (const File& list)
+    {
+        Array<RenderJob> jobs;
+        auto base = list.getParentDirectory();
+
+        StringArray lines;
+        list.readLines (lines);
+
+        for (int i = 0; i < lines.size(); i++)
+        {
+            auto line = lines[i].trim();
+            if (line.isEmpty() || line.startsWithChar ('#'))
+                continue;
+
+            StringArray tokens;
+            tokens.addTokens (line, " \t", "\"");
+            tokens.removeEmptyStrings();
+
+            if (tokens.size() != 3)
+                ConsoleApplication::fail (list.getFileName() + ":" + String (i + 1) + ": expected preset, MIDI file and output file");
+
+            jobs.add ({ resolve (base, tokens[0]), resolve (base, tokens[1]), resolve (base, tokens[2]) });
+        }
+
+        return jobs;
+    }
+
+    const char* usage =
+        "Usage: papu-render [options] preset.xml input.mid output.wav|flac\n"
+        "       papu-render [options] --jobs=list.txt\n"
+        "\n"
+        "Options:\n"
+        "  --rate=N       sample rate in Hz (default 44100)\n"
+        "  --bits=N       16 or 24 bits per sample (default 16)\n"
+        "  --block=N      processing block size in samples (default 512)\n"
+        "  --tail=S       seconds rendered after the last MIDI event (default 1)\n"
+        "  --threads=N    number of worker threads (default: one per CPU)\n";
+
+    int runRender (ArgumentList args)
+    {
+        if (args.containsOption ("--help|-h") || args.size() == 0)
+        {
+            std::cout << usage;
+            return 0;
+        }
+
+        RenderOptions opts;
+        int numThreads = SystemStats::getNumCpus();
+
+        if (args.containsOption ("--rate"))    opts.sampleRate    = args.removeValueForOption ("--rate").getDoubleValue();
+        if (args.containsOption ("--bits"))    opts.bitsPerSample = args.removeValueForOption ("--bits").getIntValue();
+        if (args.containsOption ("--block"))   opts.blockSize     = args.removeValueForOption ("--block").getIntValue();
+        if (args.containsOption ("--tail"))    opts.tail          = args.removeValueForOption ("--tail").getDoubleValue();
+        if (args.containsOption ("--threads")) numThreads         = args.removeValueForOption ("--threads").getIntValue();
+
+        if (opts.sampleRate < 8000.0)                           ConsoleApplication::fail ("Invalid sample rate");
+        if (opts.bitsPerSample != 16 && opts.bitsPerSample != 24) ConsoleApplication::fail ("Only 16 and 24 bits are supported");
+        if (opts.blockSize < 1)                                 ConsoleApplication::fail ("Invalid block size");
+        if (opts.tail < 0.0)                                    ConsoleApplication::fail ("Invalid tail length");
+
+        Array<RenderJob> jobs;
+
+        if (args.containsOption ("--jobs"))
+        {
+            jobs = readJobList (File::getCurrentWorkingDirectory().getChildFile (args.removeValueForOption ("--jobs").unquoted()));
+        }
+        else
+        {
+            args.checkMinNumArguments (3);
+            jobs.add ({ args[0].resolveAsExistingFile(), args[1].resolveAsExistingFile(), args[2].resolveAsFile() });
+        }
+
+        if (jobs.isEmpty())
+            ConsoleApplication::fail ("Nothing to render");
+
+        numThreads = jlimit (1, jobs.size(), numThreads);
+
+        JobQueue queue (jobs, opts);
+        OwnedArray<RenderThread> threads;
+
+        for (int i = 0; i < numThreads; i++)
+            threads.add (new RenderThread (queue));
+
+        const auto start = Time::getMillisecondCounterHiRes();
+
+        for (auto t : threads)
+            t->startThread();
+
+        for (auto t : threads)
+            t->waitForThreadToExit (-1);
+
+        const double seconds = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        const double audioSeconds = double (queue.samplesRendered.load()) / opts.sampleRate;
+
+        log (String::formatted ("%d of %d files, %.1f s of audio in %.2f s (%.0fx realtime) on %d threads",
+                                jobs.size() - queue.numFailed.load(), jobs.size(), audioSeconds, seconds,
+                                audioSeconds / jmax (seconds, 0.001), numThreads));
+
+        return queue.numFailed.load() > 0 ? 1 : 0;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // creates the MessageManager that GinProcessor expects to exist, the
+    // message loop itself is never run
+    ScopedJuceInitialiser_GUI juceInit;
+
+    ArgumentList args (argc, argv);
+    return ConsoleApplication::invokeCatchingFailures ([&] { return runRender (args); });
+}